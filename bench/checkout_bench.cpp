@@ -0,0 +1,145 @@
+// Checkout benchmark: generates a synthetic repository, packs it and checks its
+// tree out repeatedly with different worker counts, with and without io_uring,
+// reporting files/s and the speedup over a sequential checkout.
+//
+//   checkout_bench [--files n] [--file-size bytes] [--max-workers n] [--runs n] [--keep]
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <filesystem>
+#include <unistd.h>
+#include "clone.hpp"
+#include "fixture_repo.hpp"
+
+namespace {
+
+// Check the mirror's tree out into a fresh directory whose .git points at the
+// mirror's, so every run reads the same packs; returns the elapsed seconds
+double timeCheckout(const std::string& gitDir, const ObjectId& tree, const std::string& target,
+                    const CheckoutOptions& options) {
+    std::filesystem::remove_all(target);
+    std::filesystem::create_directories(target);
+    std::filesystem::create_directory_symlink(gitDir, target + "/.git");
+    std::filesystem::path originalDir = std::filesystem::current_path();
+    std::filesystem::current_path(target);
+    resetObjectStore();
+
+    auto start = std::chrono::steady_clock::now();
+    try {
+        checkoutTree(tree, options);
+    } catch (...) {
+        std::filesystem::current_path(originalDir);
+        throw;
+    }
+    double seconds = secondsSince(start);
+    std::filesystem::current_path(originalDir);
+    resetObjectStore();
+    return seconds;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    FixtureSpec spec;
+    spec.commits = 1;
+    spec.files = 20000;
+    spec.fileSize = 2048;
+    spec.changesPerCommit = 0;
+    unsigned maxWorkers = 8;
+    int runs = 3;
+    bool keep = false;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--keep") {
+                keep = true;
+                continue;
+            }
+            if (i + 1 >= argc) {
+                std::cerr << "Usage: " << argv[0] << " [--files n] [--file-size bytes] [--max-workers n]"
+                          << " [--runs n] [--keep]\n";
+                return 1;
+            }
+            int value = parseCount(arg.c_str(), argv[++i]);
+            if (arg == "--files") spec.files = value;
+            else if (arg == "--file-size") spec.fileSize = value;
+            else if (arg == "--max-workers") maxWorkers = value;
+            else if (arg == "--runs") runs = value;
+            else throw std::runtime_error("Unknown option " + arg);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    char base[] = "/tmp/checkout-bench-XXXXXX";
+    if (!mkdtemp(base)) {
+        std::cerr << "mkdtemp failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    std::string workDir = base;
+    int exitCode = 0;
+
+    try {
+        std::cout << std::fixed << std::setprecision(3);
+
+        auto start = std::chrono::steady_clock::now();
+        generateFixtureRepository(workDir + "/source", spec);
+        cloneRepository(workDir + "/source", workDir + "/mirror");
+        std::string gitDir = workDir + "/mirror/.git";
+        std::filesystem::path originalDir = std::filesystem::current_path();
+        std::filesystem::current_path(workDir + "/mirror");
+        ObjectId tree = ObjectId::fromHex(parseCommitObject(readGitObject(peelToCommit(resolveRevision("HEAD")))).tree);
+        resetObjectStore();
+        std::filesystem::current_path(originalDir);
+        std::cout << "fixture: " << spec.files << " files of " << spec.fileSize << " bytes, packed in "
+                  << secondsSince(start) << " s\n";
+        std::cout << "io_uring: " << (IoUring::supported() ? "available" : "unavailable") << ", "
+                  << std::thread::hardware_concurrency() << " core(s)\n";
+
+        std::vector<unsigned> workerCounts;
+        for (unsigned workers = 1; workers <= maxWorkers; workers *= 2) {
+            workerCounts.push_back(workers);
+        }
+
+        // Warm the page cache so the first configuration is not penalized
+        timeCheckout(gitDir, tree, workDir + "/checkout", {1, false});
+
+        double baseline = 0;
+        for (unsigned workers : workerCounts) {
+            for (bool useIoUring : {false, true}) {
+                if (useIoUring && (workers == 1 || !IoUring::supported())) {
+                    continue;
+                }
+                double best = 0;
+                for (int run = 0; run < runs; run++) {
+                    double seconds = timeCheckout(gitDir, tree, workDir + "/checkout", {workers, useIoUring});
+                    best = run == 0 ? seconds : std::min(best, seconds);
+                }
+                if (baseline == 0) {
+                    baseline = best;
+                }
+                std::cout << std::setw(2) << workers << " worker(s)" << (useIoUring ? ", io_uring " : ", threads  ")
+                          << ": " << best << " s, " << std::setprecision(0) << std::setw(7)
+                          << spec.files / best << " files/s, " << std::setprecision(2) << baseline / best
+                          << "x\n" << std::setprecision(3);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "benchmark failed: " << e.what() << std::endl;
+        exitCode = 1;
+    }
+
+    if (keep) {
+        std::cout << "kept " << workDir << "\n";
+    } else {
+        std::filesystem::remove_all(workDir);
+    }
+    return exitCode;
+}
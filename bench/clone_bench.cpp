@@ -0,0 +1,168 @@
+// End-to-end clone benchmark: generates a synthetic repository, serves it over
+// smart HTTP from a loopback server and clones it repeatedly, reporting throughput,
+// peak memory and where the time went.
+//
+//   clone_bench [--commits n] [--files n] [--file-size bytes] [--changes n] [--runs n] [--keep]
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <filesystem>
+#include <curl/curl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "clone.hpp"
+#include "fixture_repo.hpp"
+#include "loopback_server.hpp"
+
+namespace {
+
+struct RunResult {
+    CloneStats stats;
+    double totalSeconds = 0;
+    bool ok = false;
+};
+
+// Clone in a child process so each run starts cold and its peak RSS is its own
+bool runClone(const std::string& url, const std::string& targetDir, RunResult& result, long& peakRssKb) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        throw std::runtime_error("pipe failed");
+    }
+    // Anything still buffered would otherwise be printed by both processes
+    std::cout.flush();
+    std::cerr.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        throw std::runtime_error("fork failed");
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        RunResult child;
+        try {
+            curl_global_init(CURL_GLOBAL_ALL);
+            auto start = std::chrono::steady_clock::now();
+            cloneRepository(url, targetDir, {}, &child.stats);
+            child.totalSeconds = secondsSince(start);
+            child.ok = true;
+            curl_global_cleanup();
+        } catch (const std::exception& e) {
+            std::cerr << "clone failed: " << e.what() << std::endl;
+        }
+        ssize_t written = write(fds[1], &child, sizeof(child));
+        _exit(written == sizeof(child) && child.ok ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t got = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status = 0;
+    rusage usage{};
+    wait4(pid, &status, 0, &usage);
+    peakRssKb = usage.ru_maxrss;
+    return got == sizeof(result) && result.ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    FixtureSpec spec;
+    int runs = 3;
+    bool keep = false;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--keep") {
+                keep = true;
+                continue;
+            }
+            if (i + 1 >= argc) {
+                std::cerr << "Usage: " << argv[0] << " [--commits n] [--files n] [--file-size bytes]"
+                          << " [--changes n] [--runs n] [--keep]\n";
+                return 1;
+            }
+            int value = parseCount(arg.c_str(), argv[++i]);
+            if (arg == "--commits") spec.commits = value;
+            else if (arg == "--files") spec.files = value;
+            else if (arg == "--file-size") spec.fileSize = value;
+            else if (arg == "--changes") spec.changesPerCommit = value;
+            else if (arg == "--runs") runs = value;
+            else throw std::runtime_error("Unknown option " + arg);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    char base[] = "/tmp/clone-bench-XXXXXX";
+    if (!mkdtemp(base)) {
+        std::cerr << "mkdtemp failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    std::string workDir = base;
+    int exitCode = 0;
+
+    try {
+        std::cout << std::fixed << std::setprecision(3);
+
+        auto start = std::chrono::steady_clock::now();
+        FixtureResult fixture = generateFixtureRepository(workDir + "/source", spec);
+        // Pack the loose fixture through a local clone so the server streams from a packfile
+        cloneRepository(workDir + "/source", workDir + "/mirror");
+        std::cout << "fixture: " << spec.commits << " commits, " << spec.files << " files of " << spec.fileSize
+                  << " bytes, " << fixture.objects << " objects written in " << secondsSince(start) << " s\n";
+
+        LoopbackServer server(workDir + "/mirror/.git");
+        std::cout << "serving on " << server.url() << "\n";
+
+        double totalMBps = 0;
+        int completed = 0;
+        for (int run = 1; run <= runs; run++) {
+            std::string target = workDir + "/clone-" + std::to_string(run);
+            RunResult result;
+            long peakRssKb = 0;
+            int connectionsBefore = server.connections();
+            if (!runClone(server.url(), target, result, peakRssKb)) {
+                std::cout << "run " << run << ": failed\n";
+                exitCode = 1;
+                continue;
+            }
+
+            const CloneStats& s = result.stats;
+            double megabytes = s.packBytes / (1024.0 * 1024.0);
+            double mbps = s.downloadSeconds > 0 ? megabytes / s.downloadSeconds : 0;
+            double objectsPerSecond = result.totalSeconds > 0 ? s.objects / result.totalSeconds : 0;
+            std::cout << "run " << run << ": " << s.objects << " objects, " << megabytes << " MB in "
+                      << result.totalSeconds << " s\n"
+                      << "  negotiation " << s.negotiationSeconds << " s, download " << s.downloadSeconds
+                      << " s, index " << s.indexSeconds << " s, checkout " << s.checkoutSeconds << " s\n"
+                      << "  " << std::setprecision(1) << mbps << " MB/s, " << objectsPerSecond
+                      << " objects/s, peak RSS " << peakRssKb / 1024.0 << " MB, "
+                      << server.connections() - connectionsBefore << " connection(s)\n" << std::setprecision(3);
+            totalMBps += mbps;
+            completed++;
+            if (!keep) {
+                std::filesystem::remove_all(target);
+            }
+        }
+        if (completed > 0) {
+            std::cout << "mean download throughput: " << std::setprecision(1) << totalMBps / completed
+                      << " MB/s over " << completed << " runs\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "benchmark failed: " << e.what() << std::endl;
+        exitCode = 1;
+    }
+
+    if (keep) {
+        std::cout << "kept " << workDir << "\n";
+    } else {
+        std::filesystem::remove_all(workDir);
+    }
+    return exitCode;
+}
@@ -0,0 +1,141 @@
+#ifndef FIXTURE_REPO
+#define FIXTURE_REPO
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <stdexcept>
+#include <fstream>
+#include <filesystem>
+#include "util.hpp"
+
+// Value of a numeric benchmark option: a whole number from 1 to INT_MAX, so it
+// fits every count and size field it is stored in
+int parseCount(const char* flag, const char* value) {
+    char* end = nullptr;
+    errno = 0;
+    long number = std::strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || errno == ERANGE || number <= 0 || number > INT_MAX) {
+        throw std::runtime_error(std::string("Invalid value for ") + flag + ": " + value);
+    }
+    return static_cast<int>(number);
+}
+
+// Shape of a synthetic repository: a linear history where every commit rewrites
+// a few files in a tree of fixed-size directories
+struct FixtureSpec {
+    int commits = 100;
+    int files = 1000;
+    size_t fileSize = 4096;
+    int changesPerCommit = 10;
+    int filesPerDir = 64;
+};
+
+struct FixtureResult {
+    std::string head;
+    size_t objects = 0;
+};
+
+// Deterministic text-like content, so blobs deflate roughly as source code does
+std::string fixtureContent(uint64_t seed, size_t size) {
+    static const char* words[] = {"int", "return", "const", "std::string", "if", "for", "value", "size",
+                                  "data", "object", "while", "auto", "struct", "hash", "error", "void"};
+    uint64_t state = seed * 0x9E3779B97F4A7C15ULL + 1;
+    auto next = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+
+    std::string content;
+    content.reserve(size + 16);
+    while (content.size() < size) {
+        uint64_t r = next();
+        content += words[r & 15];
+        content += (r >> 8) % 9 == 0 ? '\n' : ' ';
+        if ((r >> 16) % 5 == 0) {
+            content += std::to_string((r >> 24) & 0xFFFF);
+            content += ' ';
+        }
+    }
+    content.resize(size);
+    return content;
+}
+
+// Write the repository described by spec as loose objects into <dir>/.git, with
+// refs/heads/main at the last commit. Objects are written relative to the current
+// directory, so this changes into dir and back.
+FixtureResult generateFixtureRepository(const std::string& dir, const FixtureSpec& spec) {
+    std::filesystem::path originalDir = std::filesystem::current_path();
+    std::filesystem::create_directories(std::filesystem::path(dir) / ".git" / "objects");
+    std::filesystem::create_directories(std::filesystem::path(dir) / ".git" / "refs" / "heads");
+    std::filesystem::current_path(dir);
+
+    int dirCount = (spec.files + spec.filesPerDir - 1) / spec.filesPerDir;
+    std::vector<ObjectId> blobs(spec.files);
+    std::vector<int> versions(spec.files, 0);
+    std::vector<ObjectId> dirTrees(dirCount);
+    std::vector<bool> dirty(dirCount, true);
+    FixtureResult result;
+
+    auto name = [](const char* prefix, int index) {
+        char buffer[16];
+        std::snprintf(buffer, sizeof(buffer), "%s%05d", prefix, index);
+        return std::string(buffer);
+    };
+    auto writeBlob = [&](int file) {
+        blobs[file] = writeGitObject(fixtureContent((uint64_t(file) << 20) ^ versions[file], spec.fileSize));
+        dirty[file / spec.filesPerDir] = true;
+        result.objects++;
+    };
+
+    for (int file = 0; file < spec.files; file++) {
+        writeBlob(file);
+    }
+
+    uint64_t pick = 12345;
+    std::string parent;
+    for (int commit = 0; commit < spec.commits; commit++) {
+        if (commit > 0) {
+            for (int change = 0; change < spec.changesPerCommit; change++) {
+                pick = pick * 6364136223846793005ULL + 1442695040888963407ULL;
+                int file = int((pick >> 33) % spec.files);
+                versions[file]++;
+                writeBlob(file);
+            }
+        }
+
+        // Zero-padded names keep entries in git's tree order without sorting
+        std::vector<TreeEntry> rootEntries;
+        for (int d = 0; d < dirCount; d++) {
+            if (dirty[d]) {
+                std::vector<TreeEntry> entries;
+                for (int file = d * spec.filesPerDir; file < std::min(spec.files, (d + 1) * spec.filesPerDir); file++) {
+                    entries.push_back({"100644", name("f", file) + ".txt", blobs[file]});
+                }
+                dirTrees[d] = writeTreeObject(entries);
+                dirty[d] = false;
+                result.objects++;
+            }
+            rootEntries.push_back({"40000", name("d", d), dirTrees[d]});
+        }
+        ObjectId tree = writeTreeObject(rootEntries);
+        parent = writeCommitObject(tree.hex(), parent, "Commit " + std::to_string(commit + 1)).hex();
+        result.objects += 2;
+    }
+
+    std::ofstream(".git/refs/heads/main") << parent << "\n";
+    std::ofstream(".git/HEAD") << "ref: refs/heads/main\n";
+    std::filesystem::current_path(originalDir);
+    resetObjectStore();
+
+    result.head = parent;
+    return result;
+}
+
+#endif
@@ -0,0 +1,220 @@
+// Hex microbenchmark: encodes and decodes random object ids and a larger
+// buffer with the old stringstream/stoi code, the scalar kernels and the SSE2
+// and AVX2 kernels, after checking that every variant agrees with the others.
+//
+//   hex_bench [--oids n] [--buffer-size bytes] [--min-time ms]
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include "hex.hpp"
+
+namespace {
+
+// What computeSHA1 used to do for every digest
+void encodeHexStream(const unsigned char* in, size_t size, char* out) {
+    std::stringstream ss;
+    for (size_t i = 0; i < size; i++) {
+        ss << std::hex << std::setfill('0') << std::setw(2) << static_cast<int>(in[i]);
+    }
+    std::memcpy(out, ss.str().data(), size * 2);
+}
+
+// What writeTreeObject used to do for every entry
+bool decodeHexStoi(const char* in, size_t size, unsigned char* out) {
+    std::string hex(in, size * 2);
+    for (size_t i = 0; i < size; i++) {
+        out[i] = static_cast<unsigned char>(std::stoi(hex.substr(i * 2, 2), nullptr, 16));
+    }
+    return true;
+}
+
+long parseCount(const char* flag, const char* value) {
+    char* end = nullptr;
+    long number = std::strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || number <= 0) {
+        throw std::runtime_error(std::string("Invalid value for ") + flag + ": " + value);
+    }
+    return number;
+}
+
+// Run pass() until minSeconds have gone by; returns seconds per pass
+template <typename Pass>
+double timePasses(double minSeconds, Pass pass) {
+    pass();
+    size_t passes = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    do {
+        pass();
+        passes++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < minSeconds);
+    return elapsed / passes;
+}
+
+struct Input {
+    std::vector<unsigned char> oids;    // 20-byte object ids back to back
+    std::string oidHex;
+    std::vector<unsigned char> buffer;
+    std::string bufferHex;
+};
+
+struct Result {
+    double encodeNsPerOid;
+    double decodeNsPerOid;
+    double encodeMBps;
+    double decodeMBps;
+};
+
+// Every variant must round-trip random bytes of awkward lengths (upper-case
+// input included) and reject bad digits anywhere in the input
+template <auto Encode, auto Decode>
+void checkVariant(const std::string& name, bool strict) {
+    std::mt19937_64 random(7);
+    for (size_t size = 1; size <= 100; size++) {
+        std::vector<unsigned char> raw(size);
+        for (auto& byte : raw) byte = static_cast<unsigned char>(random());
+        std::string expected(size * 2, '\0');
+        encodeHexScalar(raw.data(), size, expected.data());
+
+        std::string hex(size * 2, '\0');
+        Encode(raw.data(), size, hex.data());
+        if (hex != expected) {
+            throw std::runtime_error(name + " encodes " + std::to_string(size) + " bytes wrongly");
+        }
+        for (char& c : hex) {
+            c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        }
+        std::vector<unsigned char> decoded(size);
+        if (!Decode(hex.data(), size, decoded.data()) || decoded != raw) {
+            throw std::runtime_error(name + " decodes " + std::to_string(size) + " bytes wrongly");
+        }
+        if (!strict) {
+            continue;
+        }
+        for (char bad : {'g', 'G', '/', ':', '@', '`', ' ', '\0', '\x80', '\xff'}) {
+            std::string broken = expected;
+            broken[random() % broken.size()] = bad;
+            if (Decode(broken.data(), size, decoded.data())) {
+                throw std::runtime_error(name + " accepts a non-hex digit");
+            }
+        }
+    }
+}
+
+template <auto Encode, auto Decode>
+Result benchVariant(const Input& input, double minSeconds) {
+    constexpr size_t oidSize = 20;
+    size_t oidCount = input.oids.size() / oidSize;
+    std::string encoded(std::max(input.oidHex.size(), input.bufferHex.size()), '\0');
+    std::vector<unsigned char> decoded(std::max(input.oids.size(), input.buffer.size()));
+
+    Result result;
+    result.encodeNsPerOid = timePasses(minSeconds, [&] {
+        for (size_t i = 0; i < oidCount; i++) {
+            Encode(input.oids.data() + i * oidSize, oidSize, encoded.data() + i * oidSize * 2);
+        }
+    }) / oidCount * 1e9;
+    result.decodeNsPerOid = timePasses(minSeconds, [&] {
+        for (size_t i = 0; i < oidCount; i++) {
+            Decode(input.oidHex.data() + i * oidSize * 2, oidSize, decoded.data() + i * oidSize);
+        }
+    }) / oidCount * 1e9;
+    result.encodeMBps = input.buffer.size() / timePasses(minSeconds, [&] {
+        Encode(input.buffer.data(), input.buffer.size(), encoded.data());
+    }) / 1e6;
+    result.decodeMBps = input.buffer.size() / timePasses(minSeconds, [&] {
+        Decode(input.bufferHex.data(), input.buffer.size(), decoded.data());
+    }) / 1e6;
+
+    if (std::memcmp(encoded.data(), input.bufferHex.data(), input.bufferHex.size()) != 0 ||
+        std::memcmp(decoded.data(), input.buffer.data(), input.buffer.size()) != 0) {
+        throw std::runtime_error("benchmark output does not match its input");
+    }
+    return result;
+}
+
+template <auto Encode, auto Decode>
+void runVariant(const std::string& name, const Input& input, double minSeconds, Result& baseline,
+                bool strict = true) {
+    checkVariant<Encode, Decode>(name, strict);
+    Result result = benchVariant<Encode, Decode>(input, minSeconds);
+    if (baseline.encodeNsPerOid == 0) {
+        baseline = result;
+    }
+    std::cout << std::left << std::setw(20) << name << std::right << std::setprecision(1) << std::setw(15)
+              << result.encodeNsPerOid << std::setw(15) << result.decodeNsPerOid << std::setprecision(0)
+              << std::setw(13) << result.encodeMBps << std::setw(13) << result.decodeMBps << std::setprecision(1)
+              << std::setw(9) << baseline.encodeNsPerOid / result.encodeNsPerOid << "x" << std::setw(8)
+              << baseline.decodeNsPerOid / result.decodeNsPerOid << "x\n";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    size_t oidCount = 100000;
+    size_t bufferSize = 64 * 1024;
+    double minSeconds = 0.3;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (i + 1 >= argc) {
+                std::cerr << "Usage: " << argv[0] << " [--oids n] [--buffer-size bytes] [--min-time ms]\n";
+                return 1;
+            }
+            long value = parseCount(arg.c_str(), argv[++i]);
+            if (arg == "--oids") oidCount = value;
+            else if (arg == "--buffer-size") bufferSize = value;
+            else if (arg == "--min-time") minSeconds = value / 1000.0;
+            else throw std::runtime_error("Unknown option " + arg);
+        }
+
+        Input input;
+        std::mt19937_64 random(42);
+        input.oids.resize(oidCount * 20);
+        input.buffer.resize(bufferSize);
+        for (auto& byte : input.oids) byte = static_cast<unsigned char>(random());
+        for (auto& byte : input.buffer) byte = static_cast<unsigned char>(random());
+        input.oidHex.resize(input.oids.size() * 2);
+        input.bufferHex.resize(input.buffer.size() * 2);
+        encodeHexScalar(input.oids.data(), input.oids.size(), input.oidHex.data());
+        encodeHexScalar(input.buffer.data(), input.buffer.size(), input.bufferHex.data());
+
+#ifdef HEX_X86
+        bool hasAVX2 = cpuHasAVX2();
+        std::cout << "sse2: yes, avx2: " << (hasAVX2 ? "yes" : "no");
+#else
+        std::cout << "sse2: no, avx2: no";
+#endif
+        std::cout << "; " << oidCount << " object ids, " << bufferSize << "-byte buffer\n" << std::fixed;
+        std::cout << std::left << std::setw(20) << "variant" << std::right << std::setw(15) << "encode ns/oid"
+                  << std::setw(15) << "decode ns/oid" << std::setw(13) << "enc MB/s" << std::setw(13)
+                  << "dec MB/s" << std::setw(10) << "enc/oid" << std::setw(9) << "dec/oid" << "\n";
+
+        // stoi stops at the first bad digit instead of failing, so only its output is checked
+        Result baseline{};
+        runVariant<encodeHexStream, decodeHexStoi>("stringstream/stoi", input, minSeconds, baseline, false);
+        runVariant<encodeHexScalar, decodeHexScalar>("scalar", input, minSeconds, baseline);
+#ifdef HEX_X86
+        runVariant<encodeHexSSE2, decodeHexSSE2>("sse2", input, minSeconds, baseline);
+        if (hasAVX2) {
+            runVariant<encodeHexAVX2, decodeHexAVX2>("avx2", input, minSeconds, baseline);
+        }
+#endif
+        runVariant<encodeHex, decodeHex>("encodeHex/decodeHex", input, minSeconds, baseline);
+    } catch (const std::exception& e) {
+        std::cerr << "benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
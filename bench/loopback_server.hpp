@@ -0,0 +1,261 @@
+#ifndef LOOPBACK_SERVER
+#define LOOPBACK_SERVER
+
+#include <string>
+#include <string_view>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <zlib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "upload_pack.hpp"
+
+// Stand-in for a smart-HTTP git server, good enough to benchmark clone without a
+// network or a real git installation. Listens on 127.0.0.1 at an ephemeral port
+// and answers GET .../info/refs?service=git-upload-pack and POST .../git-upload-pack
+// from the repository at gitDir, one connection at a time. Connections are kept
+// alive between requests and upload-pack responses are sent chunked, so the pack
+// reaches the client as UploadPack produces it. Gzip request bodies are accepted.
+class LoopbackServer {
+public:
+    explicit LoopbackServer(const std::string& gitDir) : uploadPack_(gitDir) {
+        listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd_ < 0) {
+            throw std::runtime_error("socket failed: " + std::string(strerror(errno)));
+        }
+        int reuse = 1;
+        setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        socklen_t addrLength = sizeof(addr);
+        if (bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+            listen(listenFd_, 16) < 0 ||
+            getsockname(listenFd_, reinterpret_cast<sockaddr*>(&addr), &addrLength) < 0) {
+            std::string error = strerror(errno);
+            close(listenFd_);
+            throw std::runtime_error("Failed to listen on 127.0.0.1: " + error);
+        }
+        port_ = ntohs(addr.sin_port);
+        thread_ = std::thread([this] { run(); });
+    }
+
+    ~LoopbackServer() {
+        stopping_ = true;
+        shutdown(listenFd_, SHUT_RDWR);
+        {
+            // A client may still hold a kept-alive connection open
+            std::lock_guard<std::mutex> lock(connectionMutex_);
+            if (connectionFd_ >= 0) {
+                shutdown(connectionFd_, SHUT_RDWR);
+            }
+        }
+
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        close(listenFd_);
+    }
+
+    LoopbackServer(const LoopbackServer&) = delete;
+    LoopbackServer& operator=(const LoopbackServer&) = delete;
+
+    int port() const { return port_; }
+    int connections() const { return connections_; }
+    std::string url(const std::string& repoName = "fixture") const {
+        return "http://127.0.0.1:" + std::to_string(port_) + "/" + repoName;
+    }
+
+private:
+    void run() {
+        while (!stopping_) {
+            int fd = accept(listenFd_, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;  // listening socket shut down
+            }
+            {
+                std::lock_guard<std::mutex> lock(connectionMutex_);
+                if (stopping_) {
+                    close(fd);
+                    break;
+                }
+                connectionFd_ = fd;
+            }
+            connections_++;
+            // Headers and body go out in separate writes; don't let Nagle hold the second back
+            int noDelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+            try {
+                handleConnection(fd);
+            } catch (const std::exception& e) {
+                std::cerr << "loopback server: " << e.what() << std::endl;
+            }
+            std::lock_guard<std::mutex> lock(connectionMutex_);
+            connectionFd_ = -1;
+            close(fd);
+        }
+    }
+
+    // Serves requests on one connection until the client closes it
+    void handleConnection(int fd) {
+        std::string buffer;
+        while (handleRequest(fd, buffer)) {
+        }
+    }
+
+    bool handleRequest(int fd, std::string& buffer) {
+        size_t headerEnd;
+        while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+            if (!readMore(fd, buffer)) {
+                return false;
+            }
+        }
+        std::string head = buffer.substr(0, headerEnd);
+        buffer.erase(0, headerEnd + 4);
+
+        size_t lineEnd = head.find("\r\n");
+        std::string requestLine = head.substr(0, lineEnd);
+        size_t methodEnd = requestLine.find(' ');
+        size_t targetEnd = requestLine.find(' ', methodEnd + 1);
+        if (methodEnd == std::string::npos || targetEnd == std::string::npos) {
+            sendAll(fd, "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n");
+            return false;
+        }
+        std::string method = requestLine.substr(0, methodEnd);
+        std::string target = requestLine.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+
+        size_t contentLength = 0;
+        bool expectContinue = false;
+        bool gzipped = false;
+        for (size_t pos = lineEnd; pos != std::string::npos && pos < head.size();) {
+            size_t next = head.find("\r\n", pos + 2);
+            std::string line = toLowerAscii(head.substr(pos + 2, next == std::string::npos ? std::string::npos
+                                                                                             : next - pos - 2));
+            if (line.rfind("content-length:", 0) == 0) {
+                contentLength = std::stoul(line.substr(15));
+            } else if (line.rfind("expect:", 0) == 0 && line.find("100-continue") != std::string::npos) {
+                expectContinue = true;
+            } else if (line.rfind("content-encoding:", 0) == 0 && line.find("gzip") != std::string::npos) {
+                gzipped = true;
+            }
+            pos = next;
+        }
+        if (expectContinue && buffer.size() < contentLength) {
+            sendAll(fd, "HTTP/1.1 100 Continue\r\n\r\n");
+        }
+        while (buffer.size() < contentLength) {
+            if (!readMore(fd, buffer)) {
+                return false;
+            }
+        }
+        std::string body = buffer.substr(0, contentLength);
+        buffer.erase(0, contentLength);
+        if (gzipped) {
+            body = gunzip(body);
+        }
+
+        if (method == "GET" && target.find("/info/refs?service=git-upload-pack") != std::string::npos) {
+            std::string advertisement = uploadPack_.advertisement();
+            sendAll(fd, "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: application/x-git-upload-pack-advertisement\r\n"
+                        "Cache-Control: no-cache\r\n"
+                        "Content-Length: " + std::to_string(advertisement.size()) + "\r\n\r\n");
+            sendAll(fd, advertisement);
+        } else if (method == "POST" && target.size() >= 16 &&
+                   target.compare(target.size() - 16, 16, "/git-upload-pack") == 0) {
+            // Chunked, so the pack streams out as UploadPack writes it and the connection stays open
+            sendAll(fd, "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: application/x-git-upload-pack-result\r\n"
+                        "Cache-Control: no-cache\r\n"
+                        "Transfer-Encoding: chunked\r\n\r\n");
+            uploadPack_.serve(body, [fd](std::string_view data) {
+                if (data.empty()) {
+                    return;
+                }
+                char size[20];
+                int length = std::snprintf(size, sizeof(size), "%zx\r\n", data.size());
+                sendAll(fd, std::string_view(size, length));
+                sendAll(fd, data);
+                sendAll(fd, "\r\n");
+            });
+            sendAll(fd, "0\r\n\r\n");
+        } else {
+            sendAll(fd, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+        }
+        return true;
+    }
+
+    static std::string gunzip(const std::string& data) {
+        z_stream strm{};
+        if (inflateInit2(&strm, 15 + 16) != Z_OK) {
+            throw std::runtime_error("Failed to initialize gzip decompression");
+        }
+        strm.avail_in = data.size();
+        strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+        std::string result;
+        char chunk[16384];
+        int ret;
+        do {
+            strm.avail_out = sizeof(chunk);
+            strm.next_out = reinterpret_cast<Bytef*>(chunk);
+            ret = inflate(&strm, Z_NO_FLUSH);
+            result.append(chunk, sizeof(chunk) - strm.avail_out);
+        } while (ret == Z_OK);
+        inflateEnd(&strm);
+        if (ret != Z_STREAM_END) {
+            throw std::runtime_error("Invalid gzip request body");
+        }
+        return result;
+    }
+
+    static bool readMore(int fd, std::string& buffer) {
+        char chunk[65536];
+        ssize_t n;
+        do {
+            n = recv(fd, chunk, sizeof(chunk), 0);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, n);
+        return true;
+    }
+
+    static void sendAll(int fd, std::string_view data) {
+        while (!data.empty()) {
+            ssize_t n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("send failed: " + std::string(strerror(errno)));
+            }
+            data.remove_prefix(n);
+        }
+    }
+
+    UploadPack uploadPack_;
+    int listenFd_ = -1;
+    int port_ = 0;
+    std::atomic<bool> stopping_{false};
+    std::atomic<int> connections_{0};
+    std::mutex connectionMutex_;
+    int connectionFd_ = -1;    // connection being served, so the destructor can cut it off
+    std::thread thread_;
+};
+
+#endif
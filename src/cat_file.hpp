@@ -0,0 +1,192 @@
+#ifndef CAT_FILE
+#define CAT_FILE
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+#include "util.hpp"
+#include "request_reader.hpp"
+#include "commit_walk.hpp"
+
+// cat-file --batch format such as "%(objectname) %(objecttype) %(objectsize)",
+// parsed once into literal text and atoms
+class BatchFormat {
+public:
+    explicit BatchFormat(const std::string& format) {
+        size_t pos = 0;
+        while (pos < format.size()) {
+            size_t start = format.find("%(", pos);
+            if (start == std::string::npos) {
+                pieces_.push_back({Atom::Literal, format.substr(pos)});
+                break;
+            }
+            size_t end = format.find(')', start);
+            if (end == std::string::npos) {
+                throw std::runtime_error("unterminated format element: " + format.substr(start));
+            }
+            if (start > pos) {
+                pieces_.push_back({Atom::Literal, format.substr(pos, start - pos)});
+            }
+            std::string name = format.substr(start + 2, end - start - 2);
+            if (name == "objectname") {
+                pieces_.push_back({Atom::ObjectName, ""});
+            } else if (name == "objecttype") {
+                pieces_.push_back({Atom::ObjectType, ""});
+            } else if (name == "objectsize") {
+                pieces_.push_back({Atom::ObjectSize, ""});
+            } else if (name == "rest") {
+                pieces_.push_back({Atom::Rest, ""});
+                usesRest_ = true;
+            } else {
+                throw std::runtime_error("unknown format element: %(" + name + ")");
+            }
+            pos = end + 1;
+        }
+    }
+
+    // With %(rest) in the format the object name ends at the first blank,
+    // otherwise the whole request line names the object
+    bool usesRest() const { return usesRest_; }
+
+    void expand(std::string& out, const ObjectId& oid, std::string_view type, uint64_t size,
+                std::string_view rest) const {
+        for (const auto& piece : pieces_) {
+            switch (piece.atom) {
+                case Atom::Literal: out += piece.text; break;
+                case Atom::ObjectName: {
+                    char hex[ObjectId::hexSize];
+                    oid.toHex(hex);
+                    out.append(hex, ObjectId::hexSize);
+                    break;
+                }
+                case Atom::ObjectType: out += type; break;
+                case Atom::ObjectSize: out += std::to_string(size); break;
+                case Atom::Rest: out += rest; break;
+            }
+        }
+    }
+
+private:
+    enum class Atom { Literal, ObjectName, ObjectType, ObjectSize, Rest };
+    struct Piece {
+        Atom atom;
+        std::string text;
+    };
+
+    std::vector<Piece> pieces_;
+    bool usesRest_ = false;
+};
+
+struct CatFileBatchOptions {
+    enum class Mode { Contents, Info, Command };   // --batch, --batch-check, --batch-command
+    Mode mode = Mode::Contents;
+    std::string format = "%(objectname) %(objecttype) %(objectsize)";
+    bool buffer = false;        // --buffer: flush only on "flush" and at the end
+};
+
+// cat-file --batch, --batch-check and --batch-command: answer one request per
+// input line from a single process and object store, so a caller reading many
+// objects pays for startup, pack and index mapping and the object caches once.
+// Output is buffered and flushed whenever input pauses, which keeps a caller
+// that waits for each answer responsive without a write per object for one
+// that streams requests. Names that do not resolve print "<name> missing";
+// a bad command or a corrupt object stops the batch; returns false then.
+bool catFileBatch(int inputFd, std::ostream& output, const CatFileBatchOptions& options) {
+    using Mode = CatFileBatchOptions::Mode;
+    BatchFormat format(options.format);
+    ObjectStore& store = objectStore();
+    std::string line;
+    std::string out;
+
+    auto flush = [&] { output.flush(); };
+    RequestReader input(inputFd, options.buffer ? std::function<void()>() : flush);
+
+    auto answer = [&](std::string_view request, bool contents) {
+        std::string_view name = request;
+        std::string_view rest;
+        if (format.usesRest()) {
+            size_t blank = request.find_first_of(" \t");
+            if (blank != std::string_view::npos) {
+                name = request.substr(0, blank);
+                size_t restStart = request.find_first_not_of(" \t", blank);
+                rest = restStart == std::string_view::npos ? std::string_view() : request.substr(restStart);
+            }
+        }
+
+        ObjectId oid;
+        bool resolved = false;
+        try {
+            resolved = ObjectId::parseHex(resolveRevision(std::string(name)), oid);
+        } catch (const std::exception&) {
+        }
+
+        // Info requests only need the header, which is read without inflating the content
+        std::string data;
+        ObjectHeader header;
+        if (resolved) {
+            try {
+                if (contents) {
+                    data = store.readObject(oid);
+                } else {
+                    header = store.readObjectHeader(oid);
+                }
+            } catch (const std::exception&) {
+                if (store.hasObject(oid)) {
+                    throw;
+                }
+                resolved = false;
+            }
+        }
+        if (!resolved) {
+            output << name << " missing\n";
+            return;
+        }
+        if (contents && !parseObjectHeader(data, header)) {
+            throw std::runtime_error("Invalid git object format: " + oid.hex());
+        }
+
+        out.clear();
+        format.expand(out, oid, header.type, header.size, rest);
+        out.push_back('\n');
+        output << out;
+        if (contents) {
+            output << std::string_view(data).substr(data.find('\0') + 1) << '\n';
+        }
+    };
+
+    try {
+        while (input.next(line)) {
+            if (options.mode != Mode::Command) {
+                answer(line, options.mode == Mode::Contents);
+                continue;
+            }
+
+            std::string_view request = line;
+            if (request == "flush") {
+                if (!options.buffer) {
+                    throw std::runtime_error("flush is only for --buffer mode");
+                }
+                flush();
+            } else if (request.rfind("contents ", 0) == 0) {
+                answer(request.substr(9), true);
+            } else if (request.rfind("info ", 0) == 0) {
+                answer(request.substr(5), false);
+            } else if (request.empty()) {
+                throw std::runtime_error("empty command in input");
+            } else {
+                throw std::runtime_error("unknown command: '" + line + "'");
+            }
+        }
+    } catch (const std::exception& e) {
+        flush();
+        std::cerr << "fatal: " << e.what() << '\n';
+        return false;
+    }
+    flush();
+    return true;
+}
+
+#endif
@@ -0,0 +1,471 @@
+#ifndef CHECKOUT
+#define CHECKOUT
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <filesystem>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "util.hpp"
+#include "git_index.hpp"
+#include "io_uring.hpp"
+
+// A file the checkout will write: path relative to the work tree root
+struct CheckoutItem {
+    std::string path;
+    uint32_t mode;
+    ObjectId oid;
+};
+
+// Tree entry names are untrusted input; never let one escape the work tree or touch .git
+bool isSafeTreeEntryName(const std::string& name) {
+    if (name.empty() || name == "." || name == ".." || name.find('/') != std::string::npos ||
+        name.find('\0') != std::string::npos) {
+        return false;
+    }
+    return toLowerAscii(name) != ".git";
+}
+
+// Walk a tree recursively, creating its directories and listing the files to write
+void collectCheckoutItems(const ObjectId& treeOid, const std::string& prefix, std::vector<CheckoutItem>& items) {
+    for (const auto& entry : parseTreeObject(readGitObject(treeOid))) {
+        if (!isSafeTreeEntryName(entry.name)) {
+            throw std::runtime_error("Refusing to check out unsafe path '" + prefix + entry.name + "'");
+        }
+        std::string path = prefix + entry.name;
+        uint32_t mode = static_cast<uint32_t>(std::stoul(entry.mode, nullptr, 8));
+        if (mode == 040000) {
+            std::filesystem::create_directories(path);
+            collectCheckoutItems(entry.oid, path + "/", items);
+        } else if (mode == gitModeRegular || mode == gitModeExecutable || mode == gitModeSymlink ||
+                   mode == gitModeGitlink) {
+            items.push_back({path, mode, entry.oid});
+        } else {
+            throw std::runtime_error("Unsupported mode " + entry.mode + " for '" + path + "'");
+        }
+    }
+}
+
+// Create dirFd/name for a file of the given mode, replacing whatever is there;
+// path is the same file relative to the work tree, for messages
+int createWorkTreeFileAt(int dirFd, const std::string& name, const std::string& path, uint32_t mode) {
+    if (unlinkat(dirFd, name.c_str(), 0) != 0 && errno != ENOENT) {
+        throw std::runtime_error("Failed to replace " + path + ": " + strerror(errno));
+    }
+    // The umask decides the final permissions, as it does for git
+    int fd = openat(dirFd, name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    mode == gitModeExecutable ? 0777 : 0666);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to create " + path + ": " + strerror(errno));
+    }
+    return fd;
+}
+
+void writeWorkTreeContent(int fd, const std::string& path, std::string_view content) {
+    while (!content.empty()) {
+        ssize_t written = write(fd, content.data(), content.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Failed to write " + path + ": " + strerror(errno));
+        }
+        content.remove_prefix(static_cast<size_t>(written));
+    }
+}
+
+// Write one blob's content to dirFd/name, replacing whatever is there
+void writeWorkTreeFileAt(int dirFd, const std::string& name, const std::string& path, uint32_t mode,
+                         std::string_view content) {
+    if (mode == gitModeSymlink) {
+        if (unlinkat(dirFd, name.c_str(), 0) != 0 && errno != ENOENT) {
+            throw std::runtime_error("Failed to replace " + path + ": " + strerror(errno));
+        }
+        if (symlinkat(std::string(content).c_str(), dirFd, name.c_str()) != 0) {
+            throw std::runtime_error("Failed to create symlink " + path + ": " + strerror(errno));
+        }
+        return;
+    }
+
+    int fd = createWorkTreeFileAt(dirFd, name, path, mode);
+    try {
+        writeWorkTreeContent(fd, path, content);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    if (close(fd) != 0) {
+        throw std::runtime_error("Failed to write " + path + ": " + strerror(errno));
+    }
+}
+
+void writeWorkTreeFile(const std::string& path, uint32_t mode, std::string_view content) {
+    writeWorkTreeFileAt(AT_FDCWD, path, path, mode, content);
+}
+
+// Write a large blob to dirFd/name as it is inflated, a piece at a time, so
+// it never has to be held in memory whole
+void streamWorkTreeFileAt(int dirFd, const std::string& name, const std::string& path, uint32_t mode,
+                          ObjectStore& store, const ObjectId& oid) {
+    int fd = createWorkTreeFileAt(dirFd, name, path, mode);
+    try {
+        store.streamObject(oid, [&](std::string_view chunk) { writeWorkTreeContent(fd, path, chunk); });
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    if (close(fd) != 0) {
+        throw std::runtime_error("Failed to write " + path + ": " + strerror(errno));
+    }
+}
+
+// Whether a blob is checked out by streaming it rather than reading it whole;
+// checks that the object is a blob on the way
+bool isStreamedCheckout(ObjectStore& store, const CheckoutItem& item) {
+    ObjectHeader header = store.readObjectHeader(item.oid);
+    if (header.type != "blob") {
+        throw std::runtime_error("Expected a blob for '" + item.path + "', got " + item.oid.hex());
+    }
+    return item.mode != gitModeSymlink && header.size >= streamedBlobSize;
+}
+
+// The content of a blob object in "blob size\0content" form
+std::string_view blobContent(const std::string& objectData, const CheckoutItem& item) {
+    size_t nullPos = objectData.find('\0');
+    if (nullPos == std::string::npos || objectData.compare(0, 5, "blob ") != 0) {
+        throw std::runtime_error("Expected a blob for '" + item.path + "', got " + item.oid.hex());
+    }
+    return std::string_view(objectData).substr(nullPos + 1);
+}
+
+struct CheckoutOptions {
+    unsigned workers = 0;       // 0: checkout.workers from the config
+    bool useIoUring = true;     // batch file creation through io_uring when the kernel offers it
+};
+
+// checkout.workers as git reads it: unset means sequential, below one means one per core
+unsigned configuredCheckoutWorkers() {
+    std::string value;
+    if (!gitConfigGetWithGlobal("checkout.workers", value)) {
+        return 1;
+    }
+    long workers;
+    try {
+        workers = std::stol(value);
+    } catch (const std::exception&) {
+        throw std::runtime_error("Invalid checkout.workers: " + value);
+    }
+    if (workers < 1) {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+    return static_cast<unsigned>(workers);
+}
+
+// Fewer files than checkout.thresholdForParallelism are not worth starting workers for
+size_t configuredParallelCheckoutThreshold() {
+    std::string value;
+    if (!gitConfigGetWithGlobal("checkout.thresholdForParallelism", value)) {
+        return 100;
+    }
+    try {
+        return std::stoul(value);
+    } catch (const std::exception&) {
+        throw std::runtime_error("Invalid checkout.thresholdForParallelism: " + value);
+    }
+}
+
+// Up to this many files of one directory make a unit of parallel work
+constexpr size_t checkoutGroupSize = 32;
+// A batch of file writes is submitted once it holds this much content
+constexpr size_t checkoutBatchBytes = 8 * 1024 * 1024;
+// The most one io_uring write can transfer; larger files are written directly
+constexpr size_t ioUringMaxWrite = 0x7ffff000;
+
+// Files of one directory, written relative to a descriptor for it so each
+// path is resolved once per group rather than once per file
+struct CheckoutGroup {
+    std::string dir;
+    std::vector<size_t> items;
+};
+
+std::vector<CheckoutGroup> groupCheckoutItems(const std::vector<CheckoutItem>& items) {
+    std::vector<CheckoutGroup> groups;
+    std::unordered_map<std::string, size_t> openGroup;
+    for (size_t i = 0; i < items.size(); i++) {
+        size_t slash = items[i].path.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : items[i].path.substr(0, slash);
+        auto it = openGroup.find(dir);
+        if (it == openGroup.end() || groups[it->second].items.size() >= checkoutGroupSize) {
+            groups.push_back({dir, {}});
+            it = openGroup.insert_or_assign(dir, groups.size() - 1).first;
+        }
+        groups[it->second].items.push_back(i);
+    }
+    return groups;
+}
+
+// One thread's share of a parallel checkout. It reads blobs through its own
+// object store and creates files with batched io_uring submissions: all opens
+// of a batch at once, then each file's write linked to its close. Anything the
+// ring cannot do (or any file it fails on) goes through the plain system calls,
+// which also produce the error messages.
+class CheckoutWorker {
+public:
+    CheckoutWorker(const std::vector<CheckoutItem>& items, std::vector<IndexEntry>& indexEntries,
+                   const std::string& objectsDir, size_t deltaBaseCacheLimit, bool useIoUring)
+        : items_(items), indexEntries_(indexEntries),
+          store_(objectsDir, deltaBaseCacheLimit, 0) {   // workers only read blobs, which are not cached
+        if (useIoUring) {
+            try {
+                ring_ = std::make_unique<IoUring>(2 * checkoutGroupSize);
+            } catch (const std::exception&) {
+                ring_.reset();
+            }
+        }
+    }
+
+    void checkoutGroup(const CheckoutGroup& group) {
+        int dirFd = open(group.dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0) {
+            throw std::runtime_error("Failed to open directory " + group.dir + ": " + strerror(errno));
+        }
+        try {
+            for (size_t index : group.items) {
+                checkoutItem(dirFd, index);
+            }
+            flush(dirFd);
+        } catch (...) {
+            batch_.clear();
+            close(dirFd);
+            throw;
+        }
+        close(dirFd);
+    }
+
+private:
+    struct PendingFile {
+        size_t index;
+        std::string name;
+        std::string objectData;
+        size_t contentOffset = 0;   // an offset, as moving a short string moves its bytes
+        int fd = -1;
+        bool done = false;
+
+        std::string_view content() const { return std::string_view(objectData).substr(contentOffset); }
+    };
+
+    static std::string baseName(const std::string& path) {
+        size_t slash = path.rfind('/');
+        return slash == std::string::npos ? path : path.substr(slash + 1);
+    }
+
+    void checkoutItem(int dirFd, size_t index) {
+        const CheckoutItem& item = items_[index];
+        if (item.mode == gitModeGitlink) {
+            std::filesystem::create_directories(item.path);
+            indexEntries_[index] = makeIndexEntry(item.path, item.mode, item.oid, {});
+            return;
+        }
+
+        if (isStreamedCheckout(store_, item)) {
+            std::string name = baseName(item.path);
+            streamWorkTreeFileAt(dirFd, name, item.path, item.mode, store_, item.oid);
+            recordIndexEntry(dirFd, index, name);
+            return;
+        }
+
+        PendingFile file{index, baseName(item.path), store_.readObject(item.oid)};
+        std::string_view content = blobContent(file.objectData, item);
+        file.contentOffset = file.objectData.size() - content.size();
+        if (!ring_ || item.mode == gitModeSymlink || content.size() > ioUringMaxWrite) {
+            writeWorkTreeFileAt(dirFd, file.name, item.path, item.mode, content);
+            recordIndexEntry(dirFd, file.index, file.name);
+            return;
+        }
+        batchBytes_ += content.size();
+        batch_.push_back(std::move(file));
+        if (batchBytes_ >= checkoutBatchBytes) {
+            flush(dirFd);
+        }
+    }
+
+    void flush(int dirFd) {
+        if (batch_.empty()) {
+            return;
+        }
+
+        // Files are created without following symlinks; an existing link or
+        // directory in the way makes the open fail and is replaced below
+        for (size_t i = 0; i < batch_.size(); i++) {
+            uint32_t mode = items_[batch_[i].index].mode;
+            ring_->prepareOpenAt(dirFd, batch_[i].name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+                                 mode == gitModeExecutable ? 0777 : 0666, i);
+        }
+        ring_->submitAndReap(static_cast<unsigned>(batch_.size()), [this](uint64_t i, int result) {
+            batch_[i].fd = result;
+        });
+
+        // Completion user data is the batch index times two, plus one for the close
+        unsigned expected = 0;
+        for (size_t i = 0; i < batch_.size(); i++) {
+            PendingFile& file = batch_[i];
+            if (file.fd < 0) {
+                continue;
+            }
+            std::string_view content = file.content();
+            if (!content.empty()) {
+                ring_->prepareWrite(file.fd, content.data(), static_cast<uint32_t>(content.size()), 0, 2 * i, true);
+                expected++;
+            }
+            ring_->prepareClose(file.fd, 2 * i + 1);
+            expected++;
+            file.done = true;
+        }
+        ring_->submitAndReap(expected, [this](uint64_t data, int result) {
+            PendingFile& file = batch_[data / 2];
+            bool isClose = data % 2 == 1;
+            if (!isClose && static_cast<size_t>(result) != file.content().size()) {
+                file.done = false;
+            } else if (isClose && result == -ECANCELED) {
+                // A short or failed write cancels the linked close
+                close(file.fd);
+                file.done = false;
+            } else if (isClose && result < 0) {
+                file.done = false;
+            }
+        });
+
+        for (auto& file : batch_) {
+            const CheckoutItem& item = items_[file.index];
+            if (!file.done) {
+                writeWorkTreeFileAt(dirFd, file.name, item.path, item.mode, file.content());
+            }
+            recordIndexEntry(dirFd, file.index, file.name);
+        }
+        batch_.clear();
+        batchBytes_ = 0;
+    }
+
+    void recordIndexEntry(int dirFd, size_t index, const std::string& name) {
+        const CheckoutItem& item = items_[index];
+        struct stat st {};
+        if (fstatat(dirFd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            throw std::runtime_error("Failed to stat " + item.path);
+        }
+        indexEntries_[index] = makeIndexEntry(item.path, item.mode, item.oid, st);
+    }
+
+    const std::vector<CheckoutItem>& items_;
+    std::vector<IndexEntry>& indexEntries_;
+    ObjectStore store_;
+    std::unique_ptr<IoUring> ring_;
+    std::vector<PendingFile> batch_;
+    size_t batchBytes_ = 0;
+};
+
+// Write items with several threads, each taking whole directory groups. The
+// object store is not thread-safe, so every worker opens its own over the same
+// packs and splits the delta base cache budget with the others.
+void checkoutItemsInParallel(const std::vector<CheckoutItem>& items, std::vector<IndexEntry>& indexEntries,
+                             unsigned threads, bool useIoUring) {
+    std::vector<CheckoutGroup> groups = groupCheckoutItems(items);
+    threads = static_cast<unsigned>(std::min<size_t>(threads, groups.size()));
+    useIoUring = useIoUring && IoUring::supported();
+    std::string objectsDir = objectStore().objectsDir();
+    size_t deltaBaseCacheLimit = gitConfigGetSize("core.deltaBaseCacheLimit", 96 * 1024 * 1024) / threads;
+
+    std::atomic<size_t> nextGroup{0};
+    std::exception_ptr failure;
+    std::mutex failureMutex;
+    std::vector<std::thread> workers;
+
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            try {
+                CheckoutWorker worker(items, indexEntries, objectsDir, deltaBaseCacheLimit, useIoUring);
+                for (size_t i = nextGroup++; i < groups.size(); i = nextGroup++) {
+                    worker.checkoutGroup(groups[i]);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(failureMutex);
+                if (!failure) {
+                    failure = std::current_exception();
+                }
+                nextGroup = groups.size();
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+// Materialize a tree into the work tree rooted at the current directory and
+// record every path in .git/index, so write-tree can trust unchanged files.
+// Submodules (gitlinks) get an empty directory, as git leaves them until
+// they are initialized. With more than one worker (checkout.workers) and
+// enough files, blobs are inflated and written on worker threads. Blobs of
+// streamedBlobSize and up are written as they inflate instead of being read
+// whole first. Returns the number of paths checked out.
+size_t checkoutTree(const ObjectId& treeOid, const CheckoutOptions& options = {}) {
+    std::vector<CheckoutItem> items;
+    collectCheckoutItems(treeOid, "", items);
+
+    // A partial clone fetches the blobs its filter left out in one request, not one by one
+    std::vector<ObjectId> blobs;
+    for (const auto& item : items) {
+        if (item.mode != gitModeGitlink) {
+            blobs.push_back(item.oid);
+        }
+    }
+    objectStore().prefetchObjects(blobs);
+
+    unsigned workers = options.workers > 0 ? options.workers : configuredCheckoutWorkers();
+    if (workers > 1 && items.size() >= configuredParallelCheckoutThreshold()) {
+        std::vector<IndexEntry> indexEntries(items.size());
+        checkoutItemsInParallel(items, indexEntries, workers, options.useIoUring);
+        writeIndexFile(std::move(indexEntries));
+        return items.size();
+    }
+
+    std::vector<IndexEntry> indexEntries;
+    indexEntries.reserve(items.size());
+    for (const auto& item : items) {
+        struct stat st {};
+        if (item.mode == gitModeGitlink) {
+            std::filesystem::create_directories(item.path);
+            indexEntries.push_back(makeIndexEntry(item.path, item.mode, item.oid, st));
+            continue;
+        }
+
+        if (isStreamedCheckout(objectStore(), item)) {
+            streamWorkTreeFileAt(AT_FDCWD, item.path, item.path, item.mode, objectStore(), item.oid);
+        } else {
+            std::string objectData = readGitObject(item.oid);
+            writeWorkTreeFile(item.path, item.mode, blobContent(objectData, item));
+        }
+        if (lstat(item.path.c_str(), &st) != 0) {
+            throw std::runtime_error("Failed to stat " + item.path);
+        }
+        indexEntries.push_back(makeIndexEntry(item.path, item.mode, item.oid, st));
+    }
+
+    writeIndexFile(std::move(indexEntries));
+    return items.size();
+}
+
+#endif
@@ -0,0 +1,517 @@
+#ifndef CLONE
+#define CLONE
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <set>
+#include <unordered_set>
+#include <memory>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <chrono>
+#include "util.hpp"
+#include "index_pack.hpp"
+#include "pkt_line.hpp"
+#include "protocol.hpp"
+#include "commit_walk.hpp"
+#include "transport.hpp"
+#include "checkout.hpp"
+
+// Where an interrupted clone records its spooled pack, and how often it syncs it
+const std::string cloneCheckpointPath = ".git/clone-checkpoint";
+constexpr uint64_t packCheckpointInterval = 8 * 1024 * 1024;
+
+// Where a clone's time went, filled in when the caller asks for it
+struct CloneStats {
+    double negotiationSeconds = 0;  // capability discovery and ref listing
+    double downloadSeconds = 0;     // receiving the pack, first indexing pass included
+    double indexSeconds = 0;        // delta resolution and writing the .idx
+    double checkoutSeconds = 0;     // populating the work tree
+    uint64_t packBytes = 0;
+    uint32_t objects = 0;
+};
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Send an upload-pack fetch request and keep the pack it returns under .git/objects/pack.
+// The response is written to disk and parsed as it arrives, so the pack is never held
+// in memory; deltas are then resolved on `threads` workers (0 = one per core) from
+// the mapped file. Shallow boundary lines sent ahead of the pack are collected in
+// shallowInfo when given. With a checkpointPath, a transfer that breaks off leaves
+// its spooled pack behind for resumeInterruptedClone. Returns the pack's base
+// name (pack-<checksum>).
+std::string fetchPackfile(Transport& transport, const RemoteAdvertisement& adv, const std::string& requestBody,
+                          bool promisor = false, ShallowInfo* shallowInfo = nullptr,
+                          CloneStats* stats = nullptr, const std::string& checkpointPath = "",
+                          unsigned threads = 0) {
+    std::string packDir = ".git/objects/pack";
+    std::filesystem::create_directories(packDir);
+    
+    PackWriter writer(packDir, packIndexThreads(threads));
+    writer.setPromisor(promisor);
+    if (!checkpointPath.empty()) {
+        writer.setCheckpoint(checkpointPath, packCheckpointInterval);
+    }
+    SideBandDemuxer demuxer(
+        [&writer](std::string_view data) {
+            writer.write(reinterpret_cast<const unsigned char*>(data.data()), data.size());
+        },
+        [](std::string_view progress) {
+            std::cerr << progress;
+        });
+    if (shallowInfo) {
+        demuxer.setLineHandler([shallowInfo](std::string_view line) { shallowInfo->parseLine(line); });
+    }
+    
+    auto downloadStart = std::chrono::steady_clock::now();
+    transport.streamRequest(adv, requestBody, [&demuxer](const char* data, size_t length) {
+        demuxer.feed(data, length);
+    });
+    if (!demuxer.packStarted()) {
+        throw std::runtime_error("No packfile found in response");
+    }
+    
+    std::cerr << "Received " << writer.bytesReceived() << " bytes, "
+              << writer.objectCount() << " objects" << std::endl;
+    double downloadSeconds = secondsSince(downloadStart);
+    
+    auto indexStart = std::chrono::steady_clock::now();
+    std::string packName = writer.finish();
+    objectStore().reprepare();
+    
+    if (stats) {
+        stats->downloadSeconds += downloadSeconds;
+        stats->indexSeconds += secondsSince(indexStart);
+        stats->packBytes += writer.bytesReceived();
+        stats->objects += writer.objectCount();
+    }
+    
+    return packName;
+}
+
+// Lazy fetch for a partial clone: all missing objects go into one fetch request,
+// and the resulting pack is marked as promised like the one from the clone
+void fetchMissingObjects(const std::string& remoteUrl, const std::vector<ObjectId>& oids) {
+    std::cerr << "Fetching " << oids.size() << " missing object" << (oids.size() == 1 ? "" : "s")
+              << " from " << remoteUrl << std::endl;
+    std::unique_ptr<Transport> transport = openTransport(remoteUrl);
+    RemoteAdvertisement adv = transport->discover();
+    if (adv.version != 2) {
+        // v0 servers only hand out advertised tips unless specially configured
+        throw std::runtime_error("Lazy fetch of missing objects needs a protocol v2 remote");
+    }
+    std::vector<std::string> wants;
+    wants.reserve(oids.size());
+    for (const auto& oid : oids) {
+        wants.push_back(oid.hex());
+    }
+    fetchPackfile(*transport, adv, fetchRequest(adv, wants), true);
+}
+
+// What a walk from the tips finds locally: the missing objects that a present
+// object refers to, and the heads of the complete part of history. A commit is
+// complete when it, its tree with everything below it and all its ancestors
+// are present, which is what a "have" tells the server. A missing commit hides
+// what lies below it from a walk from the tips, so commits known to be present
+// (e.g. those in a salvaged pack) are walked from as well.
+struct MissingObjects {
+    std::vector<ObjectId> frontier;
+    std::vector<ObjectId> completeCommits;  // complete, and no complete commit's parent
+};
+
+MissingObjects findMissingObjects(const std::vector<std::string>& tips,
+                                  const std::vector<ObjectId>& presentCommits = {}) {
+    ObjectStore& store = objectStore();
+    MissingObjects result;
+    std::unordered_map<ObjectId, bool, ObjectIdHash> complete;     // finished objects
+    std::vector<ObjectId> completeCommits;
+    std::unordered_set<ObjectId, ObjectIdHash> completeParents;
+
+    // Iterative post-order walk: an object is finished once all it refers to is
+    struct Frame {
+        ObjectId oid;
+        bool commit = false;
+        std::vector<ObjectId> refs;     // for a commit: its tree, then its parents
+        size_t next = 0;
+    };
+    std::vector<Frame> stack;
+
+    auto enter = [&](const ObjectId& oid) {
+        if (!complete.emplace(oid, false).second) {
+            return;
+        }
+        if (!store.hasObject(oid)) {
+            result.frontier.push_back(oid);
+            return;
+        }
+
+        // Blobs refer to nothing, so they are not inflated
+        Frame frame{oid, false, {}, 0};
+        std::string objectData = store.readObjectHeader(oid).type == "blob" ? "" : store.readObject(oid);
+        if (objectData.compare(0, 7, "commit ") == 0) {
+            CommitInfo commit = parseCommitObject(objectData);
+            frame.commit = true;
+            frame.refs.push_back(ObjectId::fromHex(commit.tree));
+            for (const auto& parent : commit.parents) {
+                frame.refs.push_back(ObjectId::fromHex(parent));
+            }
+        } else if (objectData.compare(0, 5, "tree ") == 0) {
+            for (const auto& entry : parseTreeObject(objectData)) {
+                if (entry.mode != "160000") {
+                    frame.refs.push_back(entry.oid);
+                }
+            }
+        } else if (objectData.compare(0, 4, "tag ") == 0) {
+            size_t objectLine = objectData.find("object ", objectData.find('\0'));
+            if (objectLine != std::string::npos) {
+                frame.refs.push_back(ObjectId::fromHex(std::string_view(objectData).substr(objectLine + 7, 40)));
+            }
+        }
+        stack.push_back(std::move(frame));
+    };
+
+    auto walk = [&](const ObjectId& start) {
+        enter(start);
+        while (!stack.empty()) {
+            Frame& frame = stack.back();
+            if (frame.next < frame.refs.size()) {
+                enter(frame.refs[frame.next++]);
+                continue;
+            }
+            bool done = std::all_of(frame.refs.begin(), frame.refs.end(),
+                                    [&](const ObjectId& ref) { return complete[ref]; });
+            complete[frame.oid] = done;
+            if (frame.commit && done) {
+                completeCommits.push_back(frame.oid);
+                completeParents.insert(frame.refs.begin() + 1, frame.refs.end());
+            }
+            stack.pop_back();
+        }
+    };
+    for (const auto& tip : tips) {
+        walk(ObjectId::fromHex(tip));
+    }
+    for (const auto& oid : presentCommits) {
+        walk(oid);
+    }
+
+    for (const auto& oid : completeCommits) {
+        if (!completeParents.count(oid)) {
+            result.completeCommits.push_back(oid);
+        }
+    }
+    return result;
+}
+
+// Commits stored in the packs of packDir
+std::vector<ObjectId> packedCommits(const std::string& packDir) {
+    std::vector<ObjectId> commits;
+    for (const auto& name : listPackIndexes(packDir)) {
+        std::string idxPath = packDir + "/" + name;
+        Packfile pack(idxPath.substr(0, idxPath.size() - 4) + ".pack", idxPath);
+        std::string type;
+        uint64_t size;
+        for (uint32_t i = 0; i < pack.index().objectCount(); i++) {
+            pack.readObjectHeader(pack.index().offsetAt(i), type, size);
+            if (type == "commit") {
+                commits.push_back(ObjectId::fromRaw(pack.index().oidAt(i)));
+            }
+        }
+    }
+    return commits;
+}
+
+// Past this many missing objects the follow-up fetch wants the tips again
+// rather than each object, so the request stays small
+constexpr size_t maxResumeWants = 10000;
+
+// Pick up after a clone whose transfer broke off: keep every complete object the
+// spooled pack received and work out the follow-up fetch. The remote cannot
+// resume a pack mid-stream, so the fetch wants the missing frontier (or the
+// tips, when that frontier is huge) and names the complete commits as haves,
+// which keeps the server from sending again what they reach. A damaged spool
+// is discarded and the whole set of tips is fetched again.
+void resumeInterruptedClone(const std::vector<std::string>& tips, std::vector<std::string>& wants,
+                            std::vector<std::string>& haves, unsigned threads = 0) {
+    std::string packDir = ".git/objects/pack";
+    PackCheckpoint checkpoint;
+    if (readPackCheckpoint(cloneCheckpointPath, checkpoint)) {
+        std::string spoolPath = packDir + "/" + checkpoint.pack;
+        try {
+            uint32_t salvaged = 0;
+            std::string packName = salvagePartialPack(packDir, spoolPath, checkpoint.offset,
+                                                      packIndexThreads(threads), salvaged);
+            if (!packName.empty()) {
+                std::cerr << "Salvaged " << salvaged << " objects from the interrupted transfer into "
+                          << packName << std::endl;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "warning: discarding interrupted transfer: " << e.what() << std::endl;
+        }
+        std::filesystem::remove(spoolPath);
+    }
+    std::filesystem::remove(cloneCheckpointPath);
+    objectStore().reprepare();
+    
+    MissingObjects missing = findMissingObjects(tips, packedCommits(packDir));
+    wants.clear();
+    haves.clear();
+    if (missing.frontier.empty()) {
+        return;
+    }
+    if (missing.frontier.size() > maxResumeWants) {
+        wants = tips;
+    } else {
+        for (const auto& oid : missing.frontier) {
+            wants.push_back(oid.hex());
+        }
+    }
+    for (const auto& oid : missing.completeCommits) {
+        haves.push_back(oid.hex());
+    }
+    std::cerr << "Resuming clone: " << missing.frontier.size() << " missing object"
+              << (missing.frontier.size() == 1 ? "" : "s") << " at the frontier, " << haves.size()
+              << " complete commit" << (haves.size() == 1 ? "" : "s") << " to build on" << std::endl;
+}
+
+// Lay out refs the way git clone does: remote branches under refs/remotes/origin,
+// tags as-is, a local branch for the remote HEAD and HEAD pointing at it
+void writeRefFile(const std::string& name, const std::string& content) {
+    std::filesystem::path path = std::filesystem::path(".git") / name;
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error("Failed to write ref " + name);
+    }
+    file << content << "\n";
+}
+
+// Apply a server's shallow/unshallow lines to .git/shallow; the file goes away once
+// the history is complete again
+void updateShallowFile(const ShallowInfo& info) {
+    std::set<std::string> commits = readShallowFile();
+    commits.insert(info.shallow.begin(), info.shallow.end());
+    for (const auto& oid : info.unshallow) {
+        commits.erase(oid);
+    }
+    
+    if (commits.empty()) {
+        std::filesystem::remove(".git/shallow");
+        return;
+    }
+    std::ofstream file(".git/shallow.lock");
+    for (const auto& oid : commits) {
+        file << oid << "\n";
+    }
+    file.close();
+    if (!file) {
+        throw std::runtime_error("Failed to write .git/shallow");
+    }
+    std::filesystem::rename(".git/shallow.lock", ".git/shallow");
+}
+
+void writeClonedRefs(const std::vector<RemoteRef>& refs, const std::string& headBranch) {
+    std::string headOid;
+    for (const auto& ref : refs) {
+        if (ref.name == "HEAD") {
+            headOid = ref.oid;
+        } else if (ref.name.rfind("refs/heads/", 0) == 0) {
+            writeRefFile("refs/remotes/origin/" + ref.name.substr(11), ref.oid);
+        } else if (ref.name.rfind("refs/tags/", 0) == 0) {
+            writeRefFile(ref.name, ref.oid);
+        }
+    }
+    
+    if (!headBranch.empty()) {
+        writeRefFile("refs/remotes/origin/HEAD", "ref: refs/remotes/origin/" + headBranch.substr(11));
+        writeRefFile(headBranch, headOid);
+        writeRefFile("HEAD", "ref: " + headBranch);
+    } else if (!headOid.empty()) {
+        writeRefFile("HEAD", headOid);
+    }
+}
+
+// A filtered clone marks origin as its promisor remote, which needs repository format 1
+void writeConfigForClone(const std::string& remoteUrl, const std::string& headBranch, const std::string& filter) {
+    std::ofstream config(".git/config");
+    if (!config) {
+        throw std::runtime_error("Failed to write .git/config");
+    }
+    config << "[core]\n"
+           << "\trepositoryformatversion = " << (filter.empty() ? 0 : 1) << "\n"
+           << "\tfilemode = true\n"
+           << "\tbare = false\n";
+    if (!filter.empty()) {
+        config << "[extensions]\n"
+               << "\tpartialclone = origin\n";
+    }
+    config << "[remote \"origin\"]\n"
+           << "\turl = " << remoteUrl << "\n"
+           << "\tfetch = +refs/heads/*:refs/remotes/origin/*\n";
+    if (!filter.empty()) {
+        config << "\tpromisor = true\n"
+               << "\tpartialclonefilter = " << filter << "\n";
+    }
+    if (headBranch.rfind("refs/heads/", 0) == 0) {
+        config << "[branch \"" << headBranch.substr(11) << "\"]\n"
+               << "\tremote = origin\n"
+               << "\tmerge = " << headBranch << "\n";
+    }
+}
+
+struct CloneOptions {
+    std::string filter;     // --filter=<spec> for a partial clone
+    int depth = 0;          // --depth=<n> for a shallow clone, 0 for full history
+};
+
+void cloneRepository(const std::string& url, const std::string& targetDir, const CloneOptions& options = {},
+                     CloneStats* stats = nullptr) {
+    if (!options.filter.empty() && !isValidFilterSpec(options.filter)) {
+        throw std::runtime_error("Unsupported filter spec: " + options.filter);
+    }
+    
+    auto negotiationStart = std::chrono::steady_clock::now();
+    
+    // Connect before changing directory so relative local paths still resolve
+    std::unique_ptr<Transport> transport = openTransport(url);
+    std::string remoteUrl = transport->url();
+    
+    // Create target directory
+    std::filesystem::create_directories(targetDir);
+    
+    // Save current directory
+    std::string originalDir = std::filesystem::current_path().string();
+    
+    // Change to target directory
+    std::filesystem::current_path(targetDir);
+    resetObjectStore();
+    bool resuming = std::filesystem::exists(cloneCheckpointPath);
+    
+    // Initialize git repository
+    std::filesystem::create_directories(".git");
+    std::filesystem::create_directories(".git/objects");
+    std::filesystem::create_directories(".git/refs");
+    std::filesystem::create_directories(".git/refs/heads");
+    
+    std::ofstream headFile(".git/HEAD");
+    if (headFile.is_open()) {
+        headFile << "ref: refs/heads/main\n";
+        headFile.close();
+    }
+    
+    RemoteAdvertisement adv = transport->discover();
+    std::cerr << "Remote speaks protocol v" << adv.version << std::endl;
+    
+    FetchOptions fetchOptions;
+    if (!options.filter.empty()) {
+        if (serverSupportsFilter(adv)) {
+            fetchOptions.filter = options.filter;
+        } else {
+            std::cerr << "warning: filtering not recognized by server, ignoring" << std::endl;
+        }
+    }
+    if (options.depth > 0) {
+        if (!serverSupportsShallow(adv)) {
+            throw std::runtime_error("Server does not support shallow clients");
+        }
+        fetchOptions.depth = options.depth;
+    }
+    
+    // v2 lists only the refs a clone needs instead of the remote's whole ref namespace
+    std::vector<RemoteRef> refs = adv.refs;
+    if (adv.version == 2) {
+        if (!adv.hasCapability("ls-refs") || !adv.hasCapability("fetch")) {
+            throw std::runtime_error("Remote does not support ls-refs and fetch");
+        }
+        refs = parseLsRefsResponse(transport->request(adv, lsRefsRequest(adv, {"HEAD", "refs/heads/", "refs/tags/"})));
+    }
+    
+    if (refs.empty()) {
+        std::cerr << "warning: You appear to have cloned an empty repository." << std::endl;
+        writeConfigForClone(remoteUrl, "", fetchOptions.filter);
+        std::filesystem::current_path(originalDir);
+        resetObjectStore();
+        return;
+    }
+    
+    std::string headBranch = remoteHeadBranch(refs);
+    std::cerr << "Remote HEAD is " << (headBranch.empty() ? "detached" : headBranch) << std::endl;
+    
+    if (stats) {
+        stats->negotiationSeconds += secondsSince(negotiationStart);
+    }
+    
+    // A full v2 clone can be resumed from what a broken transfer left behind, since
+    // v2 lets it ask for any reachable object rather than only advertised tips
+    bool resumable = adv.version == 2 && fetchOptions.filter.empty() && fetchOptions.depth == 0;
+    std::vector<std::string> wants = cloneWants(refs);
+    if (resuming && resumable) {
+        resumeInterruptedClone(cloneWants(refs), wants, fetchOptions.haves);
+    } else if (resuming) {
+        std::cerr << "warning: cannot resume this kind of clone, starting the transfer over" << std::endl;
+        PackCheckpoint checkpoint;
+        if (readPackCheckpoint(cloneCheckpointPath, checkpoint)) {
+            std::filesystem::remove(".git/objects/pack/" + checkpoint.pack);
+        }
+        std::filesystem::remove(cloneCheckpointPath);
+    }
+    
+    ShallowInfo shallowInfo;
+    if (!wants.empty()) {
+        std::string requestBody = adv.version == 2 ? fetchRequest(adv, wants, fetchOptions)
+                                                   : uploadPackRequestV0(adv, wants, fetchOptions);
+        std::cerr << "Requesting packfile for " << wants.size() << (resuming ? " objects" : " tips")
+                  << " from: " << remoteUrl << std::endl;
+        
+        // Keep the received pack as-is and index it while it downloads
+        std::string packName;
+        try {
+            packName = fetchPackfile(*transport, adv, requestBody, !fetchOptions.filter.empty(), &shallowInfo,
+                                     stats, resumable ? cloneCheckpointPath : "");
+        } catch (const std::exception&) {
+            if (std::filesystem::exists(cloneCheckpointPath)) {
+                std::cerr << "Transfer interrupted; run the same clone again to resume it" << std::endl;
+            }
+            std::filesystem::current_path(originalDir);
+            resetObjectStore();
+            throw;
+        }
+        std::cerr << "Stored " << packName << std::endl;
+    }
+    updateShallowFile(shallowInfo);
+    
+    writeClonedRefs(refs, headBranch);
+    writeConfigForClone(remoteUrl, headBranch, fetchOptions.filter);
+    
+    auto checkoutStart = std::chrono::steady_clock::now();
+    
+    // Reopen the object store so a partial clone picks up its promisor remote from the config
+    resetObjectStore();
+    
+    // Check out what HEAD points at; a remote without HEAD leaves an empty work tree
+    bool hasHead = std::any_of(refs.begin(), refs.end(), [](const RemoteRef& ref) { return ref.name == "HEAD"; });
+    if (hasHead) {
+        std::string headCommit = peelToCommit(resolveRevision("HEAD"));
+        size_t files = checkoutTree(ObjectId::fromHex(parseCommitObject(readGitObject(headCommit)).tree));
+        std::cerr << "Checked out " << files << " files at " << headCommit.substr(0, 7) << std::endl;
+    } else {
+        std::cerr << "warning: remote HEAD refers to nonexistent ref, unable to checkout" << std::endl;
+    }
+    
+    if (stats) {
+        stats->checkoutSeconds += secondsSince(checkoutStart);
+    }
+    
+    // Return to original directory
+    std::filesystem::current_path(originalDir);
+    resetObjectStore();
+    
+    std::cout << "Cloned " << url << " into " << targetDir << std::endl;
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef COMMIT_WALK
+#define COMMIT_WALK
+
+#include <string>
+#include <vector>
+#include <set>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <stdexcept>
+#include <cstdint>
+#include "util.hpp"
+
+// Commits at the shallow boundary, from <gitDir>/shallow
+std::set<std::string> readShallowFile(const std::string& gitDir = ".git") {
+    std::set<std::string> commits;
+    std::ifstream file(gitDir + "/shallow");
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty()) {
+            commits.insert(line);
+        }
+    }
+    return commits;
+}
+
+struct CommitInfo {
+    std::string tree;
+    std::vector<std::string> parents;
+    int64_t commitTime = 0;     // committer timestamp, orders the walk
+};
+
+// Parse the header of a commit object in "type size\0content" form
+CommitInfo parseCommitObject(const std::string& objectData) {
+    size_t nullPos = objectData.find('\0');
+    if (nullPos == std::string::npos || objectData.compare(0, 7, "commit ") != 0) {
+        throw std::runtime_error("Not a commit object");
+    }
+
+    CommitInfo commit;
+    size_t pos = nullPos + 1;
+    while (pos < objectData.size()) {
+        size_t end = objectData.find('\n', pos);
+        if (end == std::string::npos) {
+            end = objectData.size();
+        }
+        std::string line = objectData.substr(pos, end - pos);
+        pos = end + 1;
+        if (line.empty()) {
+            break;  // message follows
+        }
+
+        if (line.rfind("tree ", 0) == 0) {
+            commit.tree = line.substr(5);
+        } else if (line.rfind("parent ", 0) == 0) {
+            commit.parents.push_back(line.substr(7));
+        } else if (line.rfind("committer ", 0) == 0) {
+            // "committer Name <email> <timestamp> <tz>"
+            size_t emailEnd = line.rfind('>');
+            if (emailEnd != std::string::npos) {
+                try {
+                    commit.commitTime = std::stoll(line.substr(emailEnd + 1));
+                } catch (const std::exception&) {
+                    commit.commitTime = 0;
+                }
+            }
+        }
+    }
+    return commit;
+}
+
+// Resolve HEAD, a full ref, a branch/tag/remote-branch name or a full hex id to a commit id
+std::string resolveRevision(const std::string& name) {
+    if (name.size() == 40 && std::all_of(name.begin(), name.end(), ::isxdigit)) {
+        return name;
+    }
+
+    std::vector<std::string> candidates = {name, "refs/" + name, "refs/tags/" + name,
+                                           "refs/heads/" + name, "refs/remotes/" + name};
+    for (const auto& candidate : candidates) {
+        std::ifstream file(".git/" + candidate);
+        std::string content;
+        if (!file || !std::getline(file, content)) {
+            continue;
+        }
+        if (content.rfind("ref: ", 0) == 0) {
+            return resolveRevision(content.substr(5));
+        }
+        return content;
+    }
+    throw std::runtime_error("Unknown revision: " + name);
+}
+
+// Follow annotated tags down to the commit they point at
+std::string peelToCommit(std::string oid) {
+    std::string objectData = readGitObject(oid);
+    while (objectData.compare(0, 4, "tag ") == 0) {
+        size_t objectLine = objectData.find("object ", objectData.find('\0'));
+        if (objectLine == std::string::npos) {
+            throw std::runtime_error("Invalid tag object " + oid);
+        }
+        oid = objectData.substr(objectLine + 7, 40);
+        objectData = readGitObject(oid);
+    }
+    return oid;
+}
+
+// Walk history from the given commits, newest first by committer date as
+// git rev-list does. Parents of commits in .git/shallow are not followed, so a
+// shallow clone's walk ends at its boundary instead of at a missing object.
+std::vector<std::string> revList(const std::vector<std::string>& tips, size_t maxCount = 0) {
+    std::set<std::string> shallow = readShallowFile();
+    std::unordered_map<std::string, std::vector<std::string>> parents;   // commits seen so far
+    std::priority_queue<std::pair<int64_t, std::string>> queue;
+
+    auto push = [&](const std::string& oid) {
+        if (parents.count(oid)) {
+            return;
+        }
+        CommitInfo commit = parseCommitObject(readGitObject(oid));
+        parents[oid] = std::move(commit.parents);
+        queue.push({commit.commitTime, oid});
+    };
+    for (const auto& tip : tips) {
+        push(tip);
+    }
+
+    std::vector<std::string> commits;
+    while (!queue.empty() && (maxCount == 0 || commits.size() < maxCount)) {
+        std::string oid = queue.top().second;
+        queue.pop();
+        commits.push_back(oid);
+
+        if (shallow.count(oid)) {
+            continue;
+        }
+        std::vector<std::string> commitParents = parents[oid];
+        for (const auto& parent : commitParents) {
+            push(parent);
+        }
+    }
+    return commits;
+}
+
+#endif
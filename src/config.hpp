@@ -0,0 +1,158 @@
+#ifndef CONFIG
+#define CONFIG
+
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <charconv>
+#include <string_view>
+
+std::string toLowerAscii(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return value;
+}
+
+std::string trimWhitespace(const std::string& value) {
+    size_t start = value.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos) {
+        return "";
+    }
+    size_t end = value.find_last_not_of(" \t\r\n");
+    return value.substr(start, end - start + 1);
+}
+
+// Look up "section.key" or "section.subsection.key" in a git config file.
+// Section and key names are case-insensitive, subsections are not; the last
+// occurrence wins, as in git.
+bool gitConfigGet(const std::string& key, std::string& value, const std::string& configPath = ".git/config") {
+    size_t firstDot = key.find('.');
+    size_t lastDot = key.rfind('.');
+    if (firstDot == std::string::npos) {
+        return false;
+    }
+    std::string wantSection = toLowerAscii(key.substr(0, firstDot));
+    std::string wantSubsection = firstDot == lastDot ? "" : key.substr(firstDot + 1, lastDot - firstDot - 1);
+    std::string wantName = toLowerAscii(key.substr(lastDot + 1));
+
+    std::ifstream file(configPath);
+    if (!file) {
+        return false;
+    }
+
+    std::string section;
+    std::string subsection;
+    std::string line;
+    bool found = false;
+
+    while (std::getline(file, line)) {
+        line = trimWhitespace(line);
+        if (line.empty() || line[0] == '#' || line[0] == ';') {
+            continue;
+        }
+
+        if (line[0] == '[') {
+            size_t close = line.find(']');
+            std::string header = line.substr(1, close == std::string::npos ? std::string::npos : close - 1);
+            size_t quote = header.find('"');
+            if (quote != std::string::npos) {
+                section = toLowerAscii(trimWhitespace(header.substr(0, quote)));
+                size_t endQuote = header.rfind('"');
+                subsection = endQuote > quote ? header.substr(quote + 1, endQuote - quote - 1) : "";
+            } else {
+                section = toLowerAscii(trimWhitespace(header));
+                subsection.clear();
+            }
+            continue;
+        }
+
+        if (section != wantSection || subsection != wantSubsection) {
+            continue;
+        }
+
+        size_t eq = line.find('=');
+        std::string name = toLowerAscii(trimWhitespace(line.substr(0, eq)));
+        if (name != wantName) {
+            continue;
+        }
+
+        // A bare key is boolean true
+        std::string raw = eq == std::string::npos ? "true" : trimWhitespace(line.substr(eq + 1));
+        if (raw.size() >= 2 && raw.front() == '"' && raw.back() == '"') {
+            raw = raw.substr(1, raw.size() - 2);
+        }
+        value = raw;
+        found = true;
+    }
+
+    return found;
+}
+
+// Look key up in the user's global config (~/.gitconfig or
+// $XDG_CONFIG_HOME/git/config), then in the repository's, which wins
+bool gitConfigGetWithGlobal(const std::string& key, std::string& value,
+                            const std::string& configPath = ".git/config") {
+    std::string xdgConfig;
+    if (const char* xdg = std::getenv("XDG_CONFIG_HOME"); xdg && *xdg) {
+        xdgConfig = std::string(xdg) + "/git/config";
+    } else if (const char* home = std::getenv("HOME"); home && *home) {
+        xdgConfig = std::string(home) + "/.config/git/config";
+    }
+    std::string homeConfig;
+    if (const char* home = std::getenv("HOME"); home && *home) {
+        homeConfig = std::string(home) + "/.gitconfig";
+    }
+
+    bool found = false;
+    for (const std::string& path : {xdgConfig, homeConfig, configPath}) {
+        if (!path.empty() && gitConfigGet(key, value, path)) {
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Parse all of value as an unsigned decimal integer; signs, trailing text and overflow are rejected
+bool parseUnsigned(std::string_view value, uint64_t& number) {
+    const char* end = value.data() + value.size();
+    auto [parsed, error] = std::from_chars(value.data(), end, number);
+    return !value.empty() && error == std::errc() && parsed == end;
+}
+
+// Parse an integer with git's k/m/g suffixes
+bool parseSizeWithUnit(std::string value, uint64_t& size) {
+    if (value.empty()) {
+        return false;
+    }
+    uint64_t multiplier = 1;
+    switch (std::tolower(static_cast<unsigned char>(value.back()))) {
+        case 'k': multiplier = 1024; break;
+        case 'm': multiplier = 1024 * 1024; break;
+        case 'g': multiplier = 1024 * 1024 * 1024; break;
+    }
+    if (multiplier != 1) {
+        value.pop_back();
+    }
+
+    try {
+        size = std::stoull(value) * multiplier;
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+// Integer config value with git's k/m/g suffixes
+uint64_t gitConfigGetSize(const std::string& key, uint64_t defaultValue, const std::string& configPath = ".git/config") {
+    std::string value;
+    uint64_t size;
+    if (!gitConfigGet(key, value, configPath) || !parseSizeWithUnit(value, size)) {
+        return defaultValue;
+    }
+    return size;
+}
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef GIT_INDEX
+#define GIT_INDEX
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <sys/stat.h>
+#include "pack.hpp"
+
+// File modes as git records them in trees and the index
+constexpr uint32_t gitModeRegular = 0100644;
+constexpr uint32_t gitModeExecutable = 0100755;
+constexpr uint32_t gitModeSymlink = 0120000;
+constexpr uint32_t gitModeGitlink = 0160000;
+
+// One tracked path in .git/index with the stat data it had when its blob was hashed
+struct IndexEntry {
+    uint32_t ctimeSeconds = 0;
+    uint32_t ctimeNanoseconds = 0;
+    uint32_t mtimeSeconds = 0;
+    uint32_t mtimeNanoseconds = 0;
+    uint32_t dev = 0;
+    uint32_t ino = 0;
+    uint32_t mode = 0;
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    uint32_t size = 0;
+    ObjectId oid;
+    std::string path;   // relative to the work tree, '/'-separated
+};
+
+// Tree and index mode for a file as lstat saw it; only the owner's x bit counts
+uint32_t gitModeForStat(const struct stat& st) {
+    if (S_ISLNK(st.st_mode)) {
+        return gitModeSymlink;
+    }
+    return (st.st_mode & S_IXUSR) ? gitModeExecutable : gitModeRegular;
+}
+
+IndexEntry makeIndexEntry(const std::string& path, uint32_t mode, const ObjectId& oid, const struct stat& st) {
+    IndexEntry entry;
+    entry.ctimeSeconds = static_cast<uint32_t>(st.st_ctim.tv_sec);
+    entry.ctimeNanoseconds = static_cast<uint32_t>(st.st_ctim.tv_nsec);
+    entry.mtimeSeconds = static_cast<uint32_t>(st.st_mtim.tv_sec);
+    entry.mtimeNanoseconds = static_cast<uint32_t>(st.st_mtim.tv_nsec);
+    entry.dev = static_cast<uint32_t>(st.st_dev);
+    entry.ino = static_cast<uint32_t>(st.st_ino);
+    entry.mode = mode;
+    entry.uid = st.st_uid;
+    entry.gid = st.st_gid;
+    entry.size = static_cast<uint32_t>(st.st_size);
+    entry.oid = oid;
+    entry.path = path;
+    return entry;
+}
+
+// Write a version 2 index, entries sorted by path, through a lock file
+void writeIndexFile(std::vector<IndexEntry> entries, const std::string& indexPath = ".git/index") {
+    std::sort(entries.begin(), entries.end(), [](const IndexEntry& a, const IndexEntry& b) {
+        return a.path < b.path;
+    });
+
+    std::string out = "DIRC";
+    appendBE32(out, 2);
+    appendBE32(out, static_cast<uint32_t>(entries.size()));
+    for (const auto& entry : entries) {
+        size_t start = out.size();
+        for (uint32_t value : {entry.ctimeSeconds, entry.ctimeNanoseconds, entry.mtimeSeconds,
+                               entry.mtimeNanoseconds, entry.dev, entry.ino, entry.mode, entry.uid,
+                               entry.gid, entry.size}) {
+            appendBE32(out, value);
+        }
+        out.append(reinterpret_cast<const char*>(entry.oid.data()), ObjectId::rawSize);
+        uint16_t flags = static_cast<uint16_t>(std::min<size_t>(entry.path.size(), 0xFFF));
+        out.push_back(static_cast<char>(flags >> 8));
+        out.push_back(static_cast<char>(flags & 0xFF));
+        out.append(entry.path);
+        // NUL-terminated and padded to a multiple of eight bytes
+        size_t length = out.size() - start;
+        out.append(8 - length % 8, '\0');
+    }
+
+    unsigned char checksum[20];
+    Sha1Context ctx;
+    ctx.update(out.data(), out.size());
+    ctx.final(checksum);
+    out.append(reinterpret_cast<const char*>(checksum), 20);
+
+    std::string lockPath = indexPath + ".lock";
+    {
+        std::ofstream file(lockPath, std::ios::binary | std::ios::trunc);
+        file.write(out.data(), static_cast<std::streamsize>(out.size()));
+        if (!file) {
+            throw std::runtime_error("Failed to write " + lockPath);
+        }
+    }
+    std::filesystem::rename(lockPath, indexPath);
+}
+
+// Read a version 2 or 3 index; returns false if there is none
+bool readIndexFile(std::vector<IndexEntry>& entries, const std::string& indexPath = ".git/index") {
+    std::ifstream file(indexPath, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const unsigned char* raw = reinterpret_cast<const unsigned char*>(data.data());
+    if (data.size() < 32 || std::memcmp(raw, "DIRC", 4) != 0) {
+        throw std::runtime_error("Invalid index file " + indexPath);
+    }
+    uint32_t version = readBE32(raw + 4);
+    if (version != 2 && version != 3) {
+        throw std::runtime_error("Unsupported index version " + std::to_string(version));
+    }
+
+    unsigned char checksum[20];
+    Sha1Context ctx;
+    ctx.update(raw, data.size() - 20);
+    ctx.final(checksum);
+    if (std::memcmp(checksum, raw + data.size() - 20, 20) != 0) {
+        throw std::runtime_error("Index file checksum mismatch: " + indexPath);
+    }
+
+    uint32_t count = readBE32(raw + 8);
+    size_t pos = 12;
+    size_t end = data.size() - 20;
+    entries.clear();
+    entries.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        if (pos + 62 > end) {
+            throw std::runtime_error("Truncated index file " + indexPath);
+        }
+        IndexEntry entry;
+        uint32_t* fields[] = {&entry.ctimeSeconds, &entry.ctimeNanoseconds, &entry.mtimeSeconds,
+                              &entry.mtimeNanoseconds, &entry.dev, &entry.ino, &entry.mode, &entry.uid,
+                              &entry.gid, &entry.size};
+        for (size_t f = 0; f < 10; f++) {
+            *fields[f] = readBE32(raw + pos + 4 * f);
+        }
+        entry.oid = ObjectId::fromRaw(raw + pos + 40);
+        uint16_t flags = static_cast<uint16_t>((raw[pos + 60] << 8) | raw[pos + 61]);
+        size_t nameStart = pos + 62 + ((flags & 0x4000) ? 2 : 0);   // v3 extended flags
+        size_t nameEnd = nameStart < end ? data.find('\0', nameStart) : std::string::npos;
+        if (nameEnd == std::string::npos || nameEnd >= end) {
+            throw std::runtime_error("Truncated index file " + indexPath);
+        }
+        entry.path = data.substr(nameStart, nameEnd - nameStart);
+        size_t length = nameEnd - pos;
+        pos += length + (8 - length % 8);
+        entries.push_back(std::move(entry));
+    }
+    return true;
+}
+
+// Blob ids from .git/index, trusted for files whose stat data has not changed
+// since they were hashed. Entries as new as the index itself are "racily clean"
+// (the file may have changed within the same timestamp tick) and not trusted.
+class StatCache {
+public:
+    explicit StatCache(const std::string& indexPath = ".git/index") {
+        std::vector<IndexEntry> entries;
+        struct stat st;
+        if (!readIndexFile(entries, indexPath) || stat(indexPath.c_str(), &st) != 0) {
+            return;
+        }
+        loaded_ = true;
+        indexMtime_ = st.st_mtim;
+        for (auto& entry : entries) {
+            std::string path = entry.path;
+            entries_.emplace(std::move(path), std::move(entry));
+        }
+    }
+
+    bool loaded() const { return loaded_; }
+
+    const IndexEntry* find(const std::string& path) const {
+        auto it = entries_.find(path);
+        return it == entries_.end() ? nullptr : &it->second;
+    }
+
+    // The recorded blob id if path still has the mode and stat data it was hashed with
+    const IndexEntry* lookup(const std::string& path, const struct stat& st) const {
+        const IndexEntry* entry = find(path);
+        if (!entry || entry->mode != gitModeForStat(st)) {
+            return nullptr;
+        }
+        IndexEntry current = makeIndexEntry(path, entry->mode, entry->oid, st);
+        if (current.mtimeSeconds != entry->mtimeSeconds || current.mtimeNanoseconds != entry->mtimeNanoseconds ||
+            current.ctimeSeconds != entry->ctimeSeconds || current.ctimeNanoseconds != entry->ctimeNanoseconds ||
+            current.size != entry->size || current.ino != entry->ino || current.dev != entry->dev) {
+            return nullptr;
+        }
+        bool racy = entry->mtimeSeconds > static_cast<uint32_t>(indexMtime_.tv_sec) ||
+                    (entry->mtimeSeconds == static_cast<uint32_t>(indexMtime_.tv_sec) &&
+                     entry->mtimeNanoseconds >= static_cast<uint32_t>(indexMtime_.tv_nsec));
+        return racy ? nullptr : entry;
+    }
+
+private:
+    bool loaded_ = false;
+    timespec indexMtime_{};
+    std::unordered_map<std::string, IndexEntry> entries_;
+};
+
+#endif
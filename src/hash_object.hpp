@@ -0,0 +1,162 @@
+#ifndef HASH_OBJECT
+#define HASH_OBJECT
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "util.hpp"
+#include "request_reader.hpp"
+
+// Workers for hash-object --stdin-paths: one per core
+unsigned hashObjectThreads() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// hash-object --stdin-paths: read one path per line from inputFd and print each
+// file's blob id to output, in input order. The caller's thread only reads
+// paths; workers claim them from a queue and each runs the whole read, hash,
+// deflate and write sequence for its file (see hashFileAsBlob), so files are
+// hashed on all cores at once. Whichever worker completes the oldest
+// outstanding path prints every result that is now in order and flushes, so
+// a caller feeding one path at a time gets its answer straight away. At most
+// window paths are in flight, which bounds the results waiting to be printed
+// behind a slow file. The first path that fails stops the batch with its
+// error, as git does, without waiting for more input; returns false then.
+bool hashStdinPaths(int inputFd, std::ostream& output, bool write, unsigned threads) {
+    struct Result {
+        ObjectId oid;
+        std::string error;
+    };
+
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable windowOpen;
+    std::deque<std::pair<size_t, std::string>> queue;
+    std::map<size_t, Result> finished;
+    size_t submitted = 0;
+    size_t printed = 0;
+    bool closed = false;
+    bool failed = false;
+    const size_t window = std::max<size_t>(64, threads * 16);
+
+    // Signalled on failure so the reader stops waiting for the next path
+    int stopFd = eventfd(0, EFD_CLOEXEC);
+    if (stopFd < 0) {
+        throw std::runtime_error(std::string("Failed to create eventfd: ") + std::strerror(errno));
+    }
+
+    // Called with mutex held; returns the error that stopped the batch, which
+    // the caller reports once it has let go of the mutex
+    auto printReady = [&]() {
+        std::string error;
+        bool wrote = false;
+        for (auto it = finished.find(printed); it != finished.end() && !failed; it = finished.find(printed)) {
+            if (!it->second.error.empty()) {
+                error = std::move(it->second.error);
+                failed = true;
+                queue.clear();
+                break;
+            }
+            output << it->second.oid << '\n';
+            wrote = true;
+            finished.erase(it);
+            printed++;
+        }
+        if (wrote) {
+            output.flush();
+        }
+        return error;
+    };
+
+    auto worker = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            workAvailable.wait(lock, [&] { return !queue.empty() || closed || failed; });
+            if (queue.empty()) {
+                return;
+            }
+            auto [index, path] = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+
+            Result result;
+            try {
+                result.oid = hashFileAsBlob(path, write);
+            } catch (const std::exception& e) {
+                result.error = e.what();
+            }
+
+            lock.lock();
+            finished.emplace(index, std::move(result));
+            std::string error = printReady();
+            windowOpen.notify_one();
+            if (!error.empty()) {
+                lock.unlock();
+                std::cerr << "fatal: " << error << '\n';
+                uint64_t one = 1;
+                ssize_t ignored = ::write(stopFd, &one, sizeof(one));
+                (void)ignored;
+                lock.lock();
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < std::max(1u, threads); t++) {
+        workers.emplace_back(worker);
+    }
+
+    RequestReader input(inputFd, std::function<void()>(), stopFd);
+    std::string path;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            windowOpen.wait(lock, [&] { return submitted - printed < window || failed; });
+            if (failed) {
+                break;
+            }
+        }
+        bool more;
+        try {
+            more = input.next(path);
+        } catch (const std::exception& e) {
+            std::cerr << "fatal: " << e.what() << '\n';
+            std::lock_guard<std::mutex> lock(mutex);
+            failed = true;
+            queue.clear();
+            break;
+        }
+        if (!more) {
+            break;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failed) {
+            break;
+        }
+        queue.emplace_back(submitted++, std::move(path));
+        workAvailable.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+    }
+    workAvailable.notify_all();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    close(stopFd);
+    return !failed;
+}
+
+#endif
@@ -0,0 +1,247 @@
+#ifndef HEX
+#define HEX
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define HEX_X86 1
+#endif
+
+// Hex encoding and decoding of raw bytes (object ids, digests). The scalar
+// kernels are constexpr so ObjectId can use them in constant expressions; at
+// run time encodeHex/decodeHex work in 16-byte SSE2 blocks, or 32-byte AVX2
+// blocks when the CPU has AVX2 and the input is long enough for one.
+
+// Value of every byte as a hex digit (either case), or -1; a table lookup keeps
+// the scalar decoder free of the branches random digits would mispredict
+inline constexpr std::array<signed char, 256> hexDigitValues = [] {
+    std::array<signed char, 256> values{};
+    for (int c = 0; c < 256; c++) {
+        if (c >= '0' && c <= '9') values[c] = static_cast<signed char>(c - '0');
+        else if (c >= 'a' && c <= 'f') values[c] = static_cast<signed char>(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') values[c] = static_cast<signed char>(c - 'A' + 10);
+        else values[c] = -1;
+    }
+    return values;
+}();
+
+constexpr int hexDigitValue(char c) {
+    return hexDigitValues[static_cast<unsigned char>(c)];
+}
+
+// Write 2 * size lowercase hex digits for in[0, size) to out (not NUL-terminated)
+constexpr void encodeHexScalar(const unsigned char* in, size_t size, char* out) {
+    constexpr char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < size; i++) {
+        out[i * 2] = digits[in[i] >> 4];
+        out[i * 2 + 1] = digits[in[i] & 0x0F];
+    }
+}
+
+// Decode 2 * size hex digits from in into size bytes; false on any non-hex digit
+constexpr bool decodeHexScalar(const char* in, size_t size, unsigned char* out) {
+    for (size_t i = 0; i < size; i++) {
+        int high = hexDigitValue(in[i * 2]);
+        int low = hexDigitValue(in[i * 2 + 1]);
+        if ((high | low) < 0) {
+            return false;
+        }
+        out[i] = static_cast<unsigned char>((high << 4) | low);
+    }
+    return true;
+}
+
+#ifdef HEX_X86
+
+// Nibbles (0-15) to their lowercase digits: n + '0', plus 39 more for a-f
+inline __m128i hexDigitsSSE2(__m128i nibbles) {
+    __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(nibbles, _mm_add_epi8(letters, _mm_set1_epi8('0')));
+}
+
+// 16 bytes to 32 digits
+inline void encodeHexBlockSSE2(const unsigned char* in, char* out) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+    __m128i mask = _mm_set1_epi8(0x0F);
+    __m128i high = hexDigitsSSE2(_mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+    __m128i low = hexDigitsSSE2(_mm_and_si128(bytes, mask));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_unpackhi_epi8(high, low));
+}
+
+// 16 digits to their nibble values; clears valid's bits for non-hex digits.
+// Bytes of 0x80 and up compare as negative, so they fall outside both ranges.
+inline __m128i hexValuesSSE2(__m128i chars, int& valid) {
+    __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+                                    _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+    __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+    __m128i isLetter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                     _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    valid &= _mm_movemask_epi8(_mm_or_si128(isDigit, isLetter));
+    __m128i digitValues = _mm_and_si128(isDigit, _mm_sub_epi8(chars, _mm_set1_epi8('0')));
+    __m128i letterValues = _mm_and_si128(isLetter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10)));
+    return _mm_or_si128(digitValues, letterValues);
+}
+
+// Each 16-bit lane holds a high nibble in its low byte and a low nibble in its
+// high byte; fold them into one byte per lane
+inline __m128i joinNibblesSSE2(__m128i values) {
+    __m128i high = _mm_and_si128(_mm_slli_epi16(values, 4), _mm_set1_epi16(0x00F0));
+    return _mm_or_si128(high, _mm_srli_epi16(values, 8));
+}
+
+// 32 digits to 16 bytes; false on any non-hex digit
+inline bool decodeHexBlockSSE2(const char* in, unsigned char* out) {
+    int valid = 0xFFFF;
+    __m128i first = hexValuesSSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), valid);
+    __m128i second = hexValuesSSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 16)), valid);
+    if (valid != 0xFFFF) {
+        return false;
+    }
+    __m128i bytes = _mm_packus_epi16(joinNibblesSSE2(first), joinNibblesSSE2(second));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), bytes);
+    return true;
+}
+
+__attribute__((target("avx2"))) inline __m256i hexDigitsAVX2(__m256i nibbles) {
+    __m256i letters =
+        _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)), _mm256_set1_epi8('a' - '0' - 10));
+    return _mm256_add_epi8(nibbles, _mm256_add_epi8(letters, _mm256_set1_epi8('0')));
+}
+
+// 32 bytes to 64 digits. The unpacks interleave within each 128-bit lane, so
+// the lanes are put back in order before storing.
+__attribute__((target("avx2"))) inline void encodeHexBlockAVX2(const unsigned char* in, char* out) {
+    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+    __m256i mask = _mm256_set1_epi8(0x0F);
+    __m256i high = hexDigitsAVX2(_mm256_and_si256(_mm256_srli_epi16(bytes, 4), mask));
+    __m256i low = hexDigitsAVX2(_mm256_and_si256(bytes, mask));
+    __m256i first = _mm256_unpacklo_epi8(high, low);   // bytes 0-7 | 16-23
+    __m256i second = _mm256_unpackhi_epi8(high, low);  // bytes 8-15 | 24-31
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 32), _mm256_permute2x128_si256(first, second, 0x31));
+}
+
+__attribute__((target("avx2"))) inline __m256i hexValuesAVX2(__m256i chars, __m256i& valid) {
+    __m256i isDigit = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('0' - 1)),
+                                       _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), chars));
+    __m256i lower = _mm256_or_si256(chars, _mm256_set1_epi8(0x20));
+    __m256i isLetter = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                        _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+    valid = _mm256_and_si256(valid, _mm256_or_si256(isDigit, isLetter));
+    __m256i digitValues = _mm256_and_si256(isDigit, _mm256_sub_epi8(chars, _mm256_set1_epi8('0')));
+    __m256i letterValues = _mm256_and_si256(isLetter, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10)));
+    return _mm256_or_si256(digitValues, letterValues);
+}
+
+__attribute__((target("avx2"))) inline __m256i joinNibblesAVX2(__m256i values) {
+    __m256i high = _mm256_and_si256(_mm256_slli_epi16(values, 4), _mm256_set1_epi16(0x00F0));
+    return _mm256_or_si256(high, _mm256_srli_epi16(values, 8));
+}
+
+// 64 digits to 32 bytes; the pack works per lane, so its quarters are reordered
+__attribute__((target("avx2"))) inline bool decodeHexBlockAVX2(const char* in, unsigned char* out) {
+    __m256i valid = _mm256_set1_epi8(-1);
+    __m256i first = hexValuesAVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in)), valid);
+    __m256i second = hexValuesAVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 32)), valid);
+    if (_mm256_movemask_epi8(valid) != -1) {
+        return false;
+    }
+    __m256i bytes = _mm256_packus_epi16(joinNibblesAVX2(first), joinNibblesAVX2(second));
+    bytes = _mm256_permute4x64_epi64(bytes, 0xD8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), bytes);
+    return true;
+}
+
+inline bool cpuHasAVX2() {
+    static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+    return hasAVX2;
+}
+
+// A tail shorter than a block is covered by one more block ending at the last
+// byte, overlapping the previous one; a 20-byte object id takes two blocks
+inline void encodeHexSSE2(const unsigned char* in, size_t size, char* out) {
+    if (size < 16) {
+        encodeHexScalar(in, size, out);
+        return;
+    }
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        encodeHexBlockSSE2(in + i, out + i * 2);
+    }
+    if (i < size) {
+        encodeHexBlockSSE2(in + size - 16, out + (size - 16) * 2);
+    }
+}
+
+inline bool decodeHexSSE2(const char* in, size_t size, unsigned char* out) {
+    if (size < 16) {
+        return decodeHexScalar(in, size, out);
+    }
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        if (!decodeHexBlockSSE2(in + i * 2, out + i)) {
+            return false;
+        }
+    }
+    return i == size || decodeHexBlockSSE2(in + (size - 16) * 2, out + size - 16);
+}
+
+// Inputs too short for a 32-byte block go to the SSE2 code
+__attribute__((target("avx2"))) inline void encodeHexAVX2(const unsigned char* in, size_t size, char* out) {
+    if (size < 32) {
+        encodeHexSSE2(in, size, out);
+        return;
+    }
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        encodeHexBlockAVX2(in + i, out + i * 2);
+    }
+    if (i < size) {
+        encodeHexBlockAVX2(in + size - 32, out + (size - 32) * 2);
+    }
+}
+
+__attribute__((target("avx2"))) inline bool decodeHexAVX2(const char* in, size_t size, unsigned char* out) {
+    if (size < 32) {
+        return decodeHexSSE2(in, size, out);
+    }
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        if (!decodeHexBlockAVX2(in + i * 2, out + i)) {
+            return false;
+        }
+    }
+    return i == size || decodeHexBlockAVX2(in + (size - 32) * 2, out + size - 32);
+}
+
+#endif
+
+inline void encodeHex(const unsigned char* in, size_t size, char* out) {
+#ifdef HEX_X86
+    // An object id is 20 bytes, too short for a 32-byte block
+    if (size >= 32 && cpuHasAVX2()) {
+        encodeHexAVX2(in, size, out);
+    } else {
+        encodeHexSSE2(in, size, out);
+    }
+#else
+    encodeHexScalar(in, size, out);
+#endif
+}
+
+inline bool decodeHex(const char* in, size_t size, unsigned char* out) {
+#ifdef HEX_X86
+    if (size >= 32 && cpuHasAVX2()) {
+        return decodeHexAVX2(in, size, out);
+    }
+    return decodeHexSSE2(in, size, out);
+#else
+    return decodeHexScalar(in, size, out);
+#endif
+}
+
+#endif
@@ -0,0 +1,738 @@
+#ifndef INDEX_PACK
+#define INDEX_PACK
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <cerrno>
+#include <cstdlib>
+#include <zlib.h>
+#include "pack.hpp"
+
+// One entry of a pack as discovered by the parser
+struct PackEntry {
+    uint64_t offset;        // position of the entry header
+    uint64_t dataOffset;    // start of the zlib stream
+    uint64_t size;          // inflated size (delta data size for deltas)
+    uint32_t crc32;         // CRC32 of header and compressed bytes, as stored in the .idx
+    int type;               // type as stored in the pack, OBJ_OFS_DELTA/OBJ_REF_DELTA included
+    int objectType;         // type of the object once resolved, 0 until then
+    uint64_t baseOffset;    // OFS_DELTA base entry
+    ObjectId baseOid;       // REF_DELTA base object
+    ObjectId oid;           // object id once known
+};
+
+// Hash an object as git does, without concatenating "type size\0" and the content
+void hashObject(int type, const unsigned char* content, size_t size, unsigned char* oid) {
+    ObjectId id = hashGitObject(packTypeName(type), std::string_view(reinterpret_cast<const char*>(content), size));
+    std::memcpy(oid, id.data(), ObjectId::rawSize);
+}
+
+// Push-style single-pass pack parser. Bytes are fed in arbitrary chunks; one
+// z_stream is reused for every entry and the exact end of each entry is taken
+// from avail_in once inflate reports Z_STREAM_END, so compressed data is never
+// copied. Non-delta objects are hashed while they inflate; the pack checksum is
+// computed over the same pass and checked against the trailer.
+class PackStreamParser {
+public:
+    PackStreamParser() : output_(64 * 1024) {
+        if (inflateInit(&strm_) != Z_OK) {
+            throw std::runtime_error("Failed to initialize zlib decompression");
+        }
+    }
+
+    ~PackStreamParser() {
+        inflateEnd(&strm_);
+    }
+
+    PackStreamParser(const PackStreamParser&) = delete;
+    PackStreamParser& operator=(const PackStreamParser&) = delete;
+
+    void feed(const unsigned char* data, size_t length) {
+        while (length > 0) {
+            size_t used = 0;
+            switch (state_) {
+                case State::PackHeader: used = consumePackHeader(data, length); break;
+                case State::EntryHeader: used = consumeEntryHeader(data, length); break;
+                case State::EntryData: used = consumeEntryData(data, length); break;
+                case State::Trailer: used = consumeTrailer(data, length); break;
+                case State::Done:
+                    throw std::runtime_error("Invalid packfile: data after trailing checksum");
+            }
+            data += used;
+            length -= used;
+        }
+    }
+
+    // Throws unless a complete pack with a valid trailing checksum has been fed
+    void finish() const {
+        if (state_ != State::Done) {
+            throw std::runtime_error("Invalid packfile: truncated at object " + std::to_string(entries_.size()));
+        }
+    }
+
+    // When false, pass one only finds entry boundaries and leaves all OIDs zero
+    void setHashObjects(bool hashObjects) { hashObjects_ = hashObjects; }
+
+    bool done() const { return state_ == State::Done; }
+    // Entries parsed in full so far, and where the last of them ends
+    uint32_t completeEntries() const { return completeEntries_; }
+    uint64_t completeBytes() const { return completeBytes_; }
+    uint32_t objectCount() const { return objectCount_; }
+    uint64_t bytesConsumed() const { return position_; }
+    const unsigned char* packChecksum() const { return trailer_; }
+    std::vector<PackEntry>& entries() { return entries_; }
+
+private:
+    enum class State { PackHeader, EntryHeader, EntryData, Trailer, Done };
+    static constexpr size_t maxEntryHeader = 64;
+
+    // Bytes that belong to the pack body (everything but the trailer)
+    void consumed(const unsigned char* data, size_t length) {
+        packSha_.update(data, length);
+        position_ += length;
+    }
+
+    size_t consumePackHeader(const unsigned char* data, size_t length) {
+        size_t used = std::min(length, 12 - header_.size());
+        header_.append(reinterpret_cast<const char*>(data), used);
+        consumed(data, used);
+        if (header_.size() < 12) {
+            return used;
+        }
+
+        const unsigned char* raw = reinterpret_cast<const unsigned char*>(header_.data());
+        if (std::memcmp(raw, "PACK", 4) != 0) {
+            throw std::runtime_error("Invalid packfile: missing PACK signature");
+        }
+        uint32_t version = readBE32(raw + 4);
+        if (version != 2 && version != 3) {
+            throw std::runtime_error("Invalid packfile: unsupported version " + std::to_string(version));
+        }
+        objectCount_ = readBE32(raw + 8);
+        entries_.reserve(std::min<uint32_t>(objectCount_, 1u << 20));
+        header_.clear();
+        startNextEntry();
+        return used;
+    }
+
+    void startNextEntry() {
+        completeEntries_ = static_cast<uint32_t>(entries_.size());
+        completeBytes_ = position_;
+        if (entries_.size() == objectCount_) {
+            packSha_.final(computedChecksum_);
+            state_ = State::Trailer;
+        } else {
+            state_ = State::EntryHeader;
+        }
+    }
+
+    // Entry headers are at most ~40 bytes but may straddle chunks, so they are
+    // gathered in a small buffer until they parse completely
+    size_t consumeEntryHeader(const unsigned char* data, size_t length) {
+        size_t buffered = header_.size();
+        size_t take = std::min(length, maxEntryHeader - buffered);
+        header_.append(reinterpret_cast<const char*>(data), take);
+
+        size_t headerLength = parseEntryHeader(reinterpret_cast<const unsigned char*>(header_.data()), header_.size());
+        if (headerLength == 0) {
+            if (header_.size() >= maxEntryHeader) {
+                throw std::runtime_error("Invalid packfile: oversized entry header");
+            }
+            return take;
+        }
+
+        // Buffered bytes are only accounted for once the header is complete
+        size_t used = headerLength - buffered;
+        consumed(reinterpret_cast<const unsigned char*>(header_.data()), headerLength);
+        crc_ = crc32(0L, reinterpret_cast<const Bytef*>(header_.data()), static_cast<uInt>(headerLength));
+        header_.clear();
+
+        PackEntry& entry = entries_.back();
+        entry.dataOffset = position_;
+        if (hashObjects_ && entry.type != OBJ_OFS_DELTA && entry.type != OBJ_REF_DELTA) {
+            std::string objectHeader = packTypeName(entry.type) + " " + std::to_string(entry.size);
+            objectSha_.init();
+            objectSha_.update(objectHeader.c_str(), objectHeader.size() + 1);
+        }
+        state_ = State::EntryData;
+        return used;
+    }
+
+    // Returns the header length, or 0 when more bytes are needed
+    size_t parseEntryHeader(const unsigned char* data, size_t length) {
+        size_t pos = 0;
+        if (length == 0) {
+            return 0;
+        }
+        unsigned char c = data[pos++];
+        int type = (c >> 4) & 0x7;
+        uint64_t size = c & 0x0F;
+        int shift = 4;
+        while (c & 0x80) {
+            if (pos >= length) {
+                return 0;
+            }
+            if (shift > 57) {
+                throw std::runtime_error("Invalid packfile: entry size overflow");
+            }
+            c = data[pos++];
+            size |= static_cast<uint64_t>(c & 0x7F) << shift;
+            shift += 7;
+        }
+
+        PackEntry entry{};
+        entry.offset = position_;
+        entry.type = type;
+        entry.size = size;
+
+        if (type == OBJ_OFS_DELTA) {
+            if (pos >= length) {
+                return 0;
+            }
+            c = data[pos++];
+            uint64_t distance = c & 0x7F;
+            while (c & 0x80) {
+                if (pos >= length) {
+                    return 0;
+                }
+                c = data[pos++];
+                distance = ((distance + 1) << 7) | (c & 0x7F);
+            }
+            if (distance == 0 || distance > entry.offset) {
+                throw std::runtime_error("Invalid packfile: delta base offset out of range");
+            }
+            entry.baseOffset = entry.offset - distance;
+        } else if (type == OBJ_REF_DELTA) {
+            if (pos + 20 > length) {
+                return 0;
+            }
+            entry.baseOid = ObjectId::fromRaw(data + pos);
+            pos += 20;
+        } else if (packTypeName(type) == "unknown") {
+            throw std::runtime_error("Invalid packfile: unknown object type " + std::to_string(type));
+        } else {
+            entry.objectType = type;
+        }
+
+        entries_.push_back(entry);
+        return pos;
+    }
+
+    size_t consumeEntryData(const unsigned char* data, size_t length) {
+        PackEntry& entry = entries_.back();
+        bool hashing = hashObjects_ && entry.objectType != 0;
+
+        strm_.next_in = const_cast<Bytef*>(data);
+        strm_.avail_in = static_cast<uInt>(std::min<size_t>(length, UINT_MAX));
+        size_t provided = strm_.avail_in;
+
+        int ret;
+        do {
+            strm_.next_out = output_.data();
+            strm_.avail_out = static_cast<uInt>(output_.size());
+            ret = inflate(&strm_, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+                throw std::runtime_error("Invalid packfile: corrupt zlib data at offset " + std::to_string(entry.offset));
+            }
+            size_t produced = output_.size() - strm_.avail_out;
+            if (hashing && produced > 0) {
+                objectSha_.update(output_.data(), produced);
+            }
+        } while (ret == Z_OK && (strm_.avail_in > 0 || strm_.avail_out == 0));
+
+        size_t used = provided - strm_.avail_in;
+        crc_ = crc32(crc_, data, static_cast<uInt>(used));
+        consumed(data, used);
+
+        if (ret != Z_STREAM_END) {
+            return used;
+        }
+
+        if (strm_.total_out != entry.size) {
+            throw std::runtime_error("Invalid packfile: size mismatch at offset " + std::to_string(entry.offset));
+        }
+        entry.crc32 = static_cast<uint32_t>(crc_);
+        if (hashing) {
+            objectSha_.final(entry.oid.data());
+        }
+        inflateReset(&strm_);
+        startNextEntry();
+        return used;
+    }
+
+    size_t consumeTrailer(const unsigned char* data, size_t length) {
+        size_t used = std::min(length, 20 - trailerLength_);
+        std::memcpy(trailer_ + trailerLength_, data, used);
+        trailerLength_ += used;
+        if (trailerLength_ == 20) {
+            if (std::memcmp(trailer_, computedChecksum_, 20) != 0) {
+                throw std::runtime_error("Invalid packfile: trailing checksum mismatch");
+            }
+            state_ = State::Done;
+        }
+        return used;
+    }
+
+    State state_ = State::PackHeader;
+    bool hashObjects_ = true;
+    z_stream strm_{};
+    Sha1Context packSha_;
+    Sha1Context objectSha_;
+    uLong crc_ = 0;
+    std::string header_;
+    std::vector<unsigned char> output_;
+    std::vector<PackEntry> entries_;
+    uint32_t objectCount_ = 0;
+    uint32_t completeEntries_ = 0;
+    uint64_t position_ = 0;
+    uint64_t completeBytes_ = 0;
+    unsigned char computedChecksum_[20] = {};
+    unsigned char trailer_[20] = {};
+    size_t trailerLength_ = 0;
+};
+
+// Build the .idx for fully resolved entries
+void writePackIndexForEntries(const std::string& idxPath, const std::vector<PackEntry>& entries,
+                              const unsigned char* packChecksum) {
+    std::vector<PackIndexEntry> indexEntries;
+    indexEntries.reserve(entries.size());
+    for (const auto& entry : entries) {
+        PackIndexEntry indexEntry;
+        std::memcpy(indexEntry.oid, entry.oid.data(), ObjectId::rawSize);
+        indexEntry.offset = entry.offset;
+        indexEntry.crc32 = entry.crc32;
+        indexEntries.push_back(indexEntry);
+    }
+    writePackIndex(idxPath, indexEntries, packChecksum);
+}
+
+// Second pass: resolve deltas base-first. Every resolved object is looked up as
+// the base of OFS_DELTA children (by offset) and REF_DELTA children (by OID);
+// delta data is re-inflated from the complete pack, never kept from pass one.
+//
+// Each non-delta entry roots a delta tree that is owned by exactly one worker,
+// so with threads > 1 workers claim roots from a shared counter and write only
+// to the entries of their own trees. Roots whose OID was not computed in pass
+// one (see PackStreamParser's hashObjects) are inflated and hashed here too.
+// With allowMissingBases, deltas whose base is not in the pack are left with
+// objectType 0 instead of failing the whole pack.
+void resolvePackDeltas(const unsigned char* pack, size_t packSize, std::vector<PackEntry>& entries,
+                       unsigned threads = 1, bool allowMissingBases = false) {
+    std::unordered_map<uint64_t, std::vector<uint32_t>> ofsChildren;
+    std::unordered_map<ObjectId, std::vector<uint32_t>, ObjectIdHash> refChildren;
+    std::vector<uint32_t> roots;
+    size_t deltaCount = 0;
+
+    for (uint32_t i = 0; i < entries.size(); i++) {
+        if (entries[i].type == OBJ_OFS_DELTA) {
+            ofsChildren[entries[i].baseOffset].push_back(i);
+            deltaCount++;
+        } else if (entries[i].type == OBJ_REF_DELTA) {
+            refChildren[entries[i].baseOid].push_back(i);
+            deltaCount++;
+        } else {
+            roots.push_back(i);
+        }
+    }
+
+    size_t available = packSize - 20;
+    auto inflateAt = [&](const PackEntry& entry) {
+        return inflatePackData(pack + entry.dataOffset, available - entry.dataOffset, entry.size);
+    };
+
+    // The maps are only read once built, so workers can share them
+    auto childrenOf = [&](const PackEntry& entry) {
+        std::vector<uint32_t> children;
+        auto ofs = ofsChildren.find(entry.offset);
+        if (ofs != ofsChildren.end()) {
+            children = ofs->second;
+        }
+        auto ref = refChildren.find(entry.oid);
+        if (ref != refChildren.end()) {
+            children.insert(children.end(), ref->second.begin(), ref->second.end());
+        }
+        return children;
+    };
+
+    struct Pending {
+        uint32_t index;
+        std::shared_ptr<const std::string> content;
+        std::vector<uint32_t> children;
+    };
+
+    std::atomic<size_t> resolved{0};
+
+    auto resolveTree = [&](uint32_t root, bool hashRoot) {
+        PackEntry& rootEntry = entries[root];
+        std::shared_ptr<const std::string> rootContent;
+        if (hashRoot) {
+            rootContent = std::make_shared<const std::string>(inflateAt(rootEntry));
+            hashObject(rootEntry.objectType, reinterpret_cast<const unsigned char*>(rootContent->data()),
+                       rootContent->size(), rootEntry.oid.data());
+        }
+
+        std::vector<uint32_t> rootChildren = childrenOf(rootEntry);
+        if (rootChildren.empty()) {
+            return;
+        }
+        if (!rootContent) {
+            rootContent = std::make_shared<const std::string>(inflateAt(rootEntry));
+        }
+
+        // Depth-first over the delta tree keeps only the current chain of bases in memory
+        std::vector<Pending> stack;
+        stack.push_back({root, std::move(rootContent), std::move(rootChildren)});
+
+        while (!stack.empty()) {
+            Pending& top = stack.back();
+            if (top.children.empty()) {
+                stack.pop_back();
+                continue;
+            }
+            uint32_t childIndex = top.children.back();
+            top.children.pop_back();
+
+            PackEntry& child = entries[childIndex];
+            std::string delta = inflateAt(child);
+            auto content = std::make_shared<const std::string>(
+                applyDelta(*top.content, reinterpret_cast<const unsigned char*>(delta.data()), delta.size()));
+            child.objectType = entries[top.index].objectType;
+            hashObject(child.objectType, reinterpret_cast<const unsigned char*>(content->data()), content->size(),
+                       child.oid.data());
+            resolved++;
+
+            std::vector<uint32_t> grandChildren = childrenOf(child);
+            if (!grandChildren.empty()) {
+                stack.push_back({childIndex, std::move(content), std::move(grandChildren)});
+            }
+        }
+    };
+
+    // Pass one leaves an all-zero OID on roots it did not hash
+    auto needsHash = [&](uint32_t root) { return entries[root].oid.isNull(); };
+
+    if (threads <= 1) {
+        for (uint32_t root : roots) {
+            resolveTree(root, needsHash(root));
+        }
+    } else {
+        std::atomic<size_t> nextRoot{0};
+        std::exception_ptr failure;
+        std::mutex failureMutex;
+        std::vector<std::thread> workers;
+
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&]() {
+                try {
+                    for (size_t i = nextRoot++; i < roots.size(); i = nextRoot++) {
+                        resolveTree(roots[i], needsHash(roots[i]));
+                    }
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(failureMutex);
+                    if (!failure) {
+                        failure = std::current_exception();
+                    }
+                    nextRoot = roots.size();
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+
+    if (resolved != deltaCount && !allowMissingBases) {
+        throw std::runtime_error("Invalid packfile: " + std::to_string(deltaCount - resolved) +
+                                 " deltas with missing bases");
+    }
+}
+
+// Index a complete pack held in memory or mapped from disk. With threads > 1
+// the first pass only finds entry boundaries and hashing moves to the workers.
+void indexPackData(const unsigned char* pack, size_t packSize, PackStreamParser& parser, unsigned threads) {
+    parser.setHashObjects(threads <= 1);
+    parser.feed(pack, packSize);
+    parser.finish();
+    resolvePackDeltas(pack, packSize, parser.entries(), threads);
+}
+
+// Build the .idx next to a pack on disk (pack-X.pack -> pack-X.idx), returning the pack checksum
+std::string indexPackFile(const std::string& packPath, unsigned threads) {
+    MappedFile pack(packPath);
+    PackStreamParser parser;
+    indexPackData(pack.data(), pack.size(), parser, threads);
+
+    std::string idxPath = packPath;
+    if (idxPath.size() > 5 && idxPath.compare(idxPath.size() - 5, 5, ".pack") == 0) {
+        idxPath.resize(idxPath.size() - 5);
+    }
+    idxPath += ".idx";
+    writePackIndexForEntries(idxPath, parser.entries(), parser.packChecksum());
+    return oidToHex(parser.packChecksum());
+}
+
+// Where an interrupted transfer left its spooled pack, as recorded by PackWriter
+struct PackCheckpoint {
+    std::string pack;       // spool file name within the pack directory
+    uint32_t entries = 0;   // complete entries known to be on disk
+    uint64_t offset = 0;    // end of the last of them
+};
+
+bool readPackCheckpoint(const std::string& path, PackCheckpoint& checkpoint) {
+    std::ifstream file(path);
+    std::string key;
+    bool havePack = false;
+    while (file >> key) {
+        if (key == "pack") {
+            havePack = static_cast<bool>(file >> checkpoint.pack);
+        } else if (key == "entries") {
+            file >> checkpoint.entries;
+        } else if (key == "offset") {
+            file >> checkpoint.offset;
+        }
+    }
+    return havePack && checkpoint.pack.find('/') == std::string::npos;
+}
+
+// Receives a pack as it arrives: bytes are appended to a temporary file in
+// packDir and fed to the streaming parser in the same call, so downloading and
+// the first indexing pass overlap and only a small window is held in memory.
+// finish() resolves deltas from the mapped file and installs pack-<sha>.pack/.idx.
+class PackWriter {
+public:
+    PackWriter(const std::string& packDir, unsigned threads) : packDir_(packDir), threads_(threads) {
+        std::string pattern = packDir_ + "/tmp_pack_XXXXXX";
+        std::vector<char> path(pattern.begin(), pattern.end());
+        path.push_back('\0');
+        fd_ = mkstemp(path.data());
+        if (fd_ < 0) {
+            throw std::runtime_error("Failed to create temporary pack in " + packDir_);
+        }
+        tmpPath_ = path.data();
+        parser_.setHashObjects(threads_ <= 1);
+    }
+
+    ~PackWriter() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+        // A checkpointed spool outlives a failed transfer so it can be salvaged
+        if (!finished_ && checkpointPath_.empty()) {
+            unlink(tmpPath_.c_str());
+        }
+    }
+
+    PackWriter(const PackWriter&) = delete;
+    PackWriter& operator=(const PackWriter&) = delete;
+
+    void write(const unsigned char* data, size_t length) {
+        parser_.feed(data, length);
+        while (length > 0) {
+            ssize_t written = ::write(fd_, data, length);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Failed to write pack data to " + tmpPath_);
+            }
+            data += written;
+            length -= static_cast<size_t>(written);
+        }
+        if (!checkpointPath_.empty() && parser_.completeBytes() >= lastCheckpoint_ + checkpointInterval_) {
+            writeCheckpoint();
+        }
+    }
+
+    // Keep the spool if the transfer does not complete, and record in checkpointPath
+    // which file it is and how many complete entries it holds. The record is
+    // rewritten every `interval` bytes, each time after the spool has been synced,
+    // so the offset it names is always on disk. See salvagePartialPack.
+    void setCheckpoint(const std::string& checkpointPath, uint64_t interval) {
+        checkpointPath_ = checkpointPath;
+        checkpointInterval_ = interval;
+        writeCheckpoint();
+    }
+
+    // Mark the pack as coming from a promisor remote (partial clone) with a .promisor file
+    void setPromisor(bool promisor) { promisor_ = promisor; }
+
+    uint64_t bytesReceived() const { return parser_.bytesConsumed(); }
+    uint32_t objectCount() const { return parser_.objectCount(); }
+
+    // Returns the installed pack's base name (pack-<checksum>)
+    std::string finish() {
+        parser_.finish();
+        if (close(fd_) != 0) {
+            fd_ = -1;
+            throw std::runtime_error("Failed to write pack data to " + tmpPath_);
+        }
+        fd_ = -1;
+
+        std::string packName = "pack-" + oidToHex(parser_.packChecksum());
+        std::string tmpIdx = tmpPath_ + ".idx";
+        {
+            MappedFile pack(tmpPath_);
+            resolvePackDeltas(pack.data(), pack.size(), parser_.entries(), threads_);
+            writePackIndexForEntries(tmpIdx, parser_.entries(), parser_.packChecksum());
+        }
+
+        if (promisor_) {
+            std::ofstream marker(packDir_ + "/" + packName + ".promisor");
+            if (!marker) {
+                throw std::runtime_error("Failed to write " + packName + ".promisor");
+            }
+        }
+
+        // The .idx goes in last so readers never see a pack without its index
+        std::filesystem::rename(tmpPath_, packDir_ + "/" + packName + ".pack");
+        std::filesystem::rename(tmpIdx, packDir_ + "/" + packName + ".idx");
+        finished_ = true;
+        if (!checkpointPath_.empty()) {
+            std::filesystem::remove(checkpointPath_);
+        }
+        return packName;
+    }
+
+private:
+    void writeCheckpoint() {
+        if (fdatasync(fd_) != 0) {
+            throw std::runtime_error("Failed to sync " + tmpPath_);
+        }
+        std::string lockPath = checkpointPath_ + ".lock";
+        {
+            std::ofstream file(lockPath, std::ios::trunc);
+            file << "pack " << std::filesystem::path(tmpPath_).filename().string() << "\n"
+                 << "entries " << parser_.completeEntries() << "\n"
+                 << "offset " << parser_.completeBytes() << "\n";
+            if (!file) {
+                throw std::runtime_error("Failed to write " + lockPath);
+            }
+        }
+        std::filesystem::rename(lockPath, checkpointPath_);
+        lastCheckpoint_ = parser_.completeBytes();
+    }
+
+    std::string packDir_;
+    unsigned threads_;
+    std::string tmpPath_;
+    int fd_ = -1;
+    bool finished_ = false;
+    bool promisor_ = false;
+    std::string checkpointPath_;
+    uint64_t checkpointInterval_ = 0;
+    uint64_t lastCheckpoint_ = 0;
+    PackStreamParser parser_;
+};
+
+// Turn what an interrupted transfer left in a spooled pack into a pack of its own.
+// Entries are re-validated from the start (each zlib stream must end at its
+// declared size) up to the first incomplete one; a spool that fails before
+// durableOffset, which a checkpoint promised was on disk, is rejected. Deltas
+// whose base never arrived are dropped, the remaining entries are copied
+// compressed into a fresh pack (OFS_DELTA distances rewritten to match) and that
+// pack is indexed and installed. Returns its name, or "" if nothing was usable.
+std::string salvagePartialPack(const std::string& packDir, const std::string& spoolPath, uint64_t durableOffset,
+                               unsigned threads, uint32_t& salvaged) {
+    salvaged = 0;
+    std::error_code error;
+    uintmax_t spoolSize = std::filesystem::file_size(spoolPath, error);
+    if (error || spoolSize <= 12) {
+        if (durableOffset > 12) {
+            throw std::runtime_error("Checkpointed pack data is missing: " + spoolPath);
+        }
+        return "";
+    }
+
+    MappedFile spool(spoolPath);
+    PackStreamParser parser;
+    try {
+        parser.feed(spool.data(), spool.size());
+    } catch (const std::exception&) {
+        // Damage past the last complete entry is what an interrupted write looks like
+    }
+    uint64_t end = parser.completeBytes();
+    if (end < durableOffset) {
+        throw std::runtime_error("Checkpointed pack data is damaged: " + spoolPath);
+    }
+
+    std::vector<PackEntry>& entries = parser.entries();
+    entries.resize(parser.completeEntries());
+    if (entries.empty()) {
+        return "";
+    }
+    // resolvePackDeltas expects a trailer after the last entry; the bytes there are never read
+    resolvePackDeltas(spool.data(), end + 20, entries, threads, true);
+
+    std::vector<uint64_t> ends(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        ends[i] = i + 1 < entries.size() ? entries[i + 1].offset : end;
+        if (entries[i].objectType != 0) {
+            salvaged++;
+        }
+    }
+    if (salvaged == 0) {
+        return "";
+    }
+
+    PackWriter writer(packDir, threads);
+    Sha1Context checksum;
+    auto emit = [&](const void* data, size_t length) {
+        checksum.update(data, length);
+        writer.write(static_cast<const unsigned char*>(data), length);
+    };
+
+    unsigned char header[12] = {'P', 'A', 'C', 'K', 0, 0, 0, 2};
+    for (int i = 0; i < 4; i++) {
+        header[8 + i] = static_cast<unsigned char>(salvaged >> (24 - 8 * i));
+    }
+    emit(header, sizeof(header));
+
+    std::unordered_map<uint64_t, uint64_t> newOffsets;
+    uint64_t position = sizeof(header);
+    for (size_t i = 0; i < entries.size(); i++) {
+        const PackEntry& entry = entries[i];
+        if (entry.objectType == 0) {
+            continue;
+        }
+        newOffsets[entry.offset] = position;
+        std::string entryHeader = encodePackEntryHeader(entry.type, entry.size);
+        if (entry.type == OBJ_OFS_DELTA) {
+            entryHeader += encodeOffsetDelta(position - newOffsets.at(entry.baseOffset));
+        } else if (entry.type == OBJ_REF_DELTA) {
+            entryHeader.append(reinterpret_cast<const char*>(entry.baseOid.data()), ObjectId::rawSize);
+        }
+        emit(entryHeader.data(), entryHeader.size());
+        emit(spool.data() + entry.dataOffset, ends[i] - entry.dataOffset);
+        position += entryHeader.size() + (ends[i] - entry.dataOffset);
+    }
+
+    unsigned char trailer[20];
+    checksum.final(trailer);
+    writer.write(trailer, sizeof(trailer));
+    return writer.finish();
+}
+
+// Worker count for pack indexing: 0 means one per core
+unsigned packIndexThreads(unsigned requested) {
+    if (requested > 0) {
+        return requested;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef IO_URING
+#define IO_URING
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <string>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Minimal io_uring ring driven through the raw system calls, so no liburing is
+// needed. One thread owns a ring: it fills submission entries with prepare*()
+// and collects their results with submitAndReap().
+class IoUring {
+public:
+    explicit IoUring(unsigned entries) {
+        io_uring_params params{};
+        fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0) {
+            throw std::runtime_error(std::string("io_uring_setup failed: ") + strerror(errno));
+        }
+
+        sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMmap) {
+            sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+        }
+
+        sqRing_ = mapRing(sqRingSize_, IORING_OFF_SQ_RING);
+        cqRing_ = singleMmap ? sqRing_ : mapRing(cqRingSize_, IORING_OFF_CQ_RING);
+        sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(mapRing(sqesSize_, IORING_OFF_SQES));
+
+        char* sq = static_cast<char*>(sqRing_);
+        sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqEntries_ = params.sq_entries;
+
+        char* cq = static_cast<char*>(cqRing_);
+        cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        localTail_ = *sqTail_;
+        submitted_ = localTail_;
+    }
+
+    ~IoUring() { release(); }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // Whether the running kernel lets us set up a ring that can open, write and close files
+    static bool supported() {
+        static const bool result = probe();
+        return result;
+    }
+
+    unsigned capacity() const { return sqEntries_; }
+    unsigned queued() const { return localTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE); }
+
+    void prepareOpenAt(int dirFd, const char* path, int flags, mode_t mode, uint64_t userData) {
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = dirFd;
+        sqe->addr = reinterpret_cast<uint64_t>(path);
+        sqe->len = mode;
+        sqe->open_flags = static_cast<uint32_t>(flags);
+        sqe->user_data = userData;
+    }
+
+    // With link set, the next entry only runs if this write completes in full
+    void prepareWrite(int fd, const void* data, uint32_t length, uint64_t offset, uint64_t userData, bool link) {
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(data);
+        sqe->len = length;
+        sqe->off = offset;
+        sqe->flags = link ? IOSQE_IO_LINK : 0;
+        sqe->user_data = userData;
+    }
+
+    void prepareClose(int fd, uint64_t userData) {
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = fd;
+        sqe->user_data = userData;
+    }
+
+    // Submit everything prepared, then hand `count` completions (user data,
+    // result) to the callback, blocking until that many have arrived
+    template <typename Callback>
+    void submitAndReap(unsigned count, Callback&& callback) {
+        __atomic_store_n(sqTail_, localTail_, __ATOMIC_RELEASE);
+        while (localTail_ != submitted_) {
+            unsigned toSubmit = localTail_ - submitted_;
+            unsigned accepted = enter(toSubmit, std::min(count, toSubmit));
+            if (accepted == 0) {
+                throw std::runtime_error("io_uring_enter accepted no submissions");
+            }
+            submitted_ += accepted;
+        }
+        while (true) {
+            unsigned head = *cqHead_;
+            unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+            for (; head != tail && count > 0; head++, count--) {
+                const io_uring_cqe& cqe = cqes_[head & cqMask_];
+                callback(cqe.user_data, cqe.res);
+            }
+            __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+            if (count == 0) {
+                return;
+            }
+            enter(0, count);
+        }
+    }
+
+private:
+    static bool probe() {
+        try {
+            IoUring ring(4);
+            constexpr unsigned opCount = 256;
+            size_t size = sizeof(io_uring_probe) + opCount * sizeof(io_uring_probe_op);
+            std::string buffer(size, '\0');
+            auto* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+            if (syscall(__NR_io_uring_register, ring.fd_, IORING_REGISTER_PROBE, probe, opCount) < 0) {
+                return false;
+            }
+            for (unsigned op : {IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE}) {
+                if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                    return false;
+                }
+            }
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+
+    unsigned enter(unsigned toSubmit, unsigned waitFor) {
+        while (true) {
+            long ret = syscall(__NR_io_uring_enter, fd_, toSubmit, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0,
+                               nullptr, 0);
+            if (ret >= 0) {
+                return static_cast<unsigned>(ret);
+            }
+            if (errno != EINTR) {
+                throw std::runtime_error(std::string("io_uring_enter failed: ") + strerror(errno));
+            }
+        }
+    }
+
+    void release() {
+        if (sqes_) {
+            munmap(sqes_, sqesSize_);
+        }
+        if (cqRing_ && cqRing_ != sqRing_) {
+            munmap(cqRing_, cqRingSize_);
+        }
+        if (sqRing_) {
+            munmap(sqRing_, sqRingSize_);
+        }
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    void* mapRing(size_t size, off_t offset) {
+        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+        if (ptr == MAP_FAILED) {
+            int error = errno;
+            release();
+            throw std::runtime_error(std::string("io_uring mmap failed: ") + strerror(error));
+        }
+        return ptr;
+    }
+
+    io_uring_sqe* nextSqe() {
+        if (queued() >= sqEntries_) {
+            throw std::runtime_error("io_uring submission queue is full");
+        }
+        unsigned index = localTail_ & sqMask_;
+        io_uring_sqe* sqe = &sqes_[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqArray_[index] = index;
+        localTail_++;
+        return sqe;
+    }
+
+    int fd_ = -1;
+    void* sqRing_ = nullptr;
+    void* cqRing_ = nullptr;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqRingSize_ = 0;
+    size_t cqRingSize_ = 0;
+    size_t sqesSize_ = 0;
+    unsigned* sqHead_ = nullptr;
+    unsigned* sqTail_ = nullptr;
+    unsigned* sqArray_ = nullptr;
+    unsigned sqMask_ = 0;
+    unsigned sqEntries_ = 0;
+    unsigned* cqHead_ = nullptr;
+    unsigned* cqTail_ = nullptr;
+    unsigned cqMask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+    unsigned localTail_ = 0;
+    unsigned submitted_ = 0;
+};
+
+#endif
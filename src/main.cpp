@@ -6,12 +6,16 @@
 #include <zlib.h>
 #include <vector>
 #include <iomanip>
-#include <openssl/sha.h>
 #include <algorithm>
 #include <ctime>
 #include <curl/curl.h>
 #include <regex>
+#include <climits>
 #include "util.hpp"
+#include "commit_walk.hpp"
+#include "clone.hpp"
+#include "hash_object.hpp"
+#include "cat_file.hpp"
 
 int main(int argc, char *argv[]){
     // Flush after every std::cout / std::cerr
@@ -50,21 +54,74 @@ int main(int argc, char *argv[]){
             std::cerr << e.what() << '\n';
             return EXIT_FAILURE;
         }
+    } else if (command == "cat-file" && argc >= 3 && std::string(argv[2]).rfind("--batch", 0) == 0) {
+        CatFileBatchOptions options;
+        bool modeGiven = false;
+        bool valid = true;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            size_t equals = arg.find('=');
+            std::string name = arg.substr(0, equals);
+            if (name == "--batch" || name == "--batch-check" || name == "--batch-command") {
+                valid = valid && !modeGiven;
+                modeGiven = true;
+                options.mode = name == "--batch" ? CatFileBatchOptions::Mode::Contents
+                             : name == "--batch-check" ? CatFileBatchOptions::Mode::Info
+                             : CatFileBatchOptions::Mode::Command;
+                if (equals != std::string::npos) {
+                    options.format = arg.substr(equals + 1);
+                }
+            } else if (arg == "--buffer") {
+                options.buffer = true;
+            } else {
+                valid = false;
+            }
+        }
+        if (!valid) {
+            std::cerr << "Usage: cat-file (--batch | --batch-check | --batch-command)[=<format>] [--buffer]\n";
+            return EXIT_FAILURE;
+        }
+
+        try {
+            // Answers are flushed when stdin pauses, not one write at a time
+            std::cout << std::nounitbuf;
+            if (!catFileBatch(STDIN_FILENO, std::cout, options)) {
+                return EXIT_FAILURE;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "fatal: " << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
     } else if (command == "cat-file") {
         if (argc < 4) {
-            std::cerr << "Usage: cat-file -p <object>\n";
+            std::cerr << "Usage: cat-file (-p | -t | -s) <object>\n";
             return EXIT_FAILURE;
         }
         
         std::string flag = argv[2];
         std::string hash = argv[3];
         
-        if (flag != "-p") {
-            std::cerr << "Only -p flag is supported\n";
+        if (flag != "-p" && flag != "-t" && flag != "-s") {
+            std::cerr << "Only the -p, -t and -s flags are supported\n";
             return EXIT_FAILURE;
         }
         
         try {
+            // Type and size come from the object header alone
+            if (flag != "-p") {
+                ObjectId oid;
+                if (!ObjectId::parseHex(hash, oid)) {
+                    throw std::runtime_error("Not a valid object name " + hash);
+                }
+                ObjectHeader header = readGitObjectHeader(oid);
+                if (flag == "-t") {
+                    std::cout << header.type << '\n';
+                } else {
+                    std::cout << header.size << '\n';
+                }
+                return EXIT_SUCCESS;
+            }
+
             std::string objectData = readGitObject(hash);
             
             // Git object format: "type size\0content"
@@ -85,37 +142,37 @@ int main(int argc, char *argv[]){
             return EXIT_FAILURE;
         }
     } else if (command == "hash-object") {
-        if (argc < 4) {
-            std::cerr << "Usage: hash-object -w <file>\n";
-            return EXIT_FAILURE;
+        bool write = false;
+        bool stdinPaths = false;
+        std::vector<std::string> files;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-w") {
+                write = true;
+            } else if (arg == "--stdin-paths") {
+                stdinPaths = true;
+            } else {
+                files.push_back(arg);
+            }
         }
-        
-        std::string flag = argv[2];
-        std::string filename = argv[3];
-        
-        if (flag != "-w") {
-            std::cerr << "Only -w flag is supported\n";
+        if (stdinPaths ? !files.empty() : files.empty()) {
+            std::cerr << "Usage: hash-object [-w] <file>... or hash-object [-w] --stdin-paths\n";
             return EXIT_FAILURE;
         }
         
         try {
-            // Read the file content
-            std::ifstream file(filename);
-            if (!file) {
-                std::cerr << "Failed to open file: " << filename << '\n';
-                return EXIT_FAILURE;
+            if (stdinPaths) {
+                // Hashes are flushed as they come out of the pipeline, not one write at a time
+                std::cout << std::nounitbuf;
+                if (!hashStdinPaths(STDIN_FILENO, std::cout, write, hashObjectThreads())) {
+                    return EXIT_FAILURE;
+                }
+            } else {
+                // Stream each file into a blob object and print its hash
+                for (const auto& file : files) {
+                    std::cout << hashFileAsBlob(file, write) << '\n';
+                }
             }
-            
-            std::string content((std::istreambuf_iterator<char>(file)),
-                              std::istreambuf_iterator<char>());
-            file.close();
-            
-            // Create the blob object and get the hash
-            std::string hash = writeGitObject(content);
-            
-            // Print the hash
-            std::cout << hash << '\n';
-            
         } catch (const std::exception& e) {
             std::cerr << "Error creating object: " << e.what() << '\n';
             return EXIT_FAILURE;
@@ -157,11 +214,17 @@ int main(int argc, char *argv[]){
         }
     } else if (command == "write-tree") {
         try {
-            // Create tree object from current directory
-            std::string hash = createTreeFromDirectory(".");
+            // Create tree object from current directory; files unchanged since the
+            // index last saw them are not hashed again, and the index is kept fresh
+            StatCache cache;
+            std::vector<IndexEntry> seen;
+            ObjectId oid = createTreeFromDirectory(".", &cache, &seen);
+            if (cache.loaded()) {
+                writeIndexFile(std::move(seen));
+            }
             
             // Print the hash
-            std::cout << hash << '\n';
+            std::cout << oid << '\n';
             
         } catch (const std::exception& e) {
             std::cerr << "Error creating tree: " << e.what() << '\n';
@@ -204,30 +267,164 @@ int main(int argc, char *argv[]){
         
         try {
             // Create commit object
-            std::string hash = writeCommitObject(treeHash, parentHash, message);
+            ObjectId oid = writeCommitObject(treeHash, parentHash, message);
             
             // Print the hash
-            std::cout << hash << '\n';
+            std::cout << oid << '\n';
             
         } catch (const std::exception& e) {
             std::cerr << "Error creating commit: " << e.what() << '\n';
             return EXIT_FAILURE;
         }
+    } else if (command == "index-pack") {
+        if (argc < 3) {
+            std::cerr << "Usage: index-pack [--threads <n>] <pack-file>\n";
+            return EXIT_FAILURE;
+        }
+
+        unsigned threads = 0;
+        std::string packPath;
+        bool valid = true;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--threads" || arg.rfind("--threads=", 0) == 0) {
+                if (arg == "--threads" && i + 1 >= argc) {
+                    valid = false;
+                    break;
+                }
+                std::string text = arg == "--threads" ? argv[++i] : arg.substr(10);
+                uint64_t value;
+                if (!parseUnsigned(text, value) || value > UINT_MAX) {
+                    std::cerr << "fatal: invalid --threads value '" << text << "'\n";
+                    return EXIT_FAILURE;
+                }
+                threads = static_cast<unsigned>(value);
+            } else {
+                packPath = arg;
+            }
+        }
+        if (!valid || packPath.empty()) {
+            std::cerr << "Usage: index-pack [--threads <n>] <pack-file>\n";
+            return EXIT_FAILURE;
+        }
+
+        try {
+            // Write <pack>.idx next to the pack and print its checksum, as git index-pack does
+            std::cout << indexPackFile(packPath, packIndexThreads(threads)) << '\n';
+        } catch (const std::exception& e) {
+            std::cerr << "Error indexing pack: " << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
+    } else if (command == "multi-pack-index") {
+        std::string objectDir = ".git/objects";
+        std::string subcommand;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg.rfind("--object-dir=", 0) == 0) {
+                objectDir = arg.substr(13);
+            } else {
+                subcommand = arg;
+            }
+        }
+        if (subcommand != "write" && subcommand != "verify") {
+            std::cerr << "Usage: multi-pack-index [--object-dir=<dir>] (write|verify)\n";
+            return EXIT_FAILURE;
+        }
+
+        try {
+            std::string packDir = objectDir + "/pack";
+            if (subcommand == "write") {
+                size_t objects = writeMultiPackIndex(packDir);
+                std::cerr << "Indexed " << objects << " objects from " << listPackIndexes(packDir).size()
+                          << " packs\n";
+            } else {
+                size_t objects = verifyMultiPackIndex(packDir);
+                std::cerr << "Verified " << objects << " objects\n";
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "error: multi-pack-index " << subcommand << ": " << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
+    } else if (command == "rev-list") {
+        size_t maxCount = 0;
+        std::vector<std::string> revisions;
+        bool valid = true;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-n" || arg == "--max-count" || arg.rfind("--max-count=", 0) == 0) {
+                bool separate = arg.find('=') == std::string::npos;
+                if (separate && i + 1 >= argc) {
+                    valid = false;
+                    break;
+                }
+                std::string text = separate ? argv[++i] : arg.substr(12);
+                uint64_t value;
+                if (!parseUnsigned(text, value)) {
+                    std::cerr << "fatal: invalid --max-count value '" << text << "'\n";
+                    return EXIT_FAILURE;
+                }
+                maxCount = static_cast<size_t>(value);
+            } else {
+                revisions.push_back(arg);
+            }
+        }
+        if (!valid || revisions.empty()) {
+            std::cerr << "Usage: rev-list [-n <count>] <commit>...\n";
+            return EXIT_FAILURE;
+        }
+        
+        try {
+            std::vector<std::string> tips;
+            for (const auto& revision : revisions) {
+                tips.push_back(peelToCommit(resolveRevision(revision)));
+            }
+            for (const auto& commit : revList(tips, maxCount)) {
+                std::cout << commit << '\n';
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error walking history: " << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
     } else if (command == "clone") {
-        if (argc < 4) {
-            std::cerr << "Usage: clone <url> <directory>\n";
+        CloneOptions options;
+        std::vector<std::string> positional;
+        const char* usage = "Usage: clone [--depth <n>] [--filter=<filter-spec>] <url> <directory>\n";
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if ((arg == "--filter" || arg == "--depth") && i + 1 >= argc) {
+                std::cerr << usage;
+                return EXIT_FAILURE;
+            }
+            if (arg == "--filter") {
+                options.filter = argv[++i];
+            } else if (arg.rfind("--filter=", 0) == 0) {
+                options.filter = arg.substr(9);
+            } else if (arg == "--depth" || arg.rfind("--depth=", 0) == 0) {
+                std::string text = arg == "--depth" ? argv[++i] : arg.substr(8);
+                uint64_t value;
+                if (!parseUnsigned(text, value) || value == 0 || value > INT_MAX) {
+                    std::cerr << "fatal: depth " << text << " is not a positive number\n";
+                    return EXIT_FAILURE;
+                }
+                options.depth = static_cast<int>(value);
+            } else {
+                positional.push_back(arg);
+            }
+        }
+        if (positional.size() != 2) {
+            std::cerr << usage;
             return EXIT_FAILURE;
         }
         
-        std::string url = argv[2];
-        std::string targetDir = argv[3];
+        std::string url = positional[0];
+        std::string targetDir = positional[1];
         
         try {
             // Initialize CURL
             curl_global_init(CURL_GLOBAL_ALL);
             
             // Clone the repository
-            cloneRepository(url, targetDir);
+            cloneRepository(url, targetDir, options);
             
             // Cleanup CURL
             curl_global_cleanup();
@@ -0,0 +1,399 @@
+#ifndef MIDX
+#define MIDX
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <sys/stat.h>
+#include "pack.hpp"
+
+// Chunk ids of a multi-pack-index
+constexpr uint32_t midxChunkPackNames = 0x504e414d;        // "PNAM"
+constexpr uint32_t midxChunkOidFanout = 0x4f494446;        // "OIDF"
+constexpr uint32_t midxChunkOidLookup = 0x4f49444c;        // "OIDL"
+constexpr uint32_t midxChunkObjectOffsets = 0x4f4f4646;    // "OOFF"
+constexpr uint32_t midxChunkLargeOffsets = 0x4c4f4646;     // "LOFF"
+constexpr uint32_t midxLargeOffsetNeeded = 0x80000000u;
+
+// Memory-mapped multi-pack-index (objects/pack/multi-pack-index, version 1).
+// One sorted OID table covers the objects of every pack it lists, so a lookup
+// is a single fanout-narrowed binary search however many packs there are.
+// Layout:
+//   "MIDX", version, hash version, chunk count, base count (0), pack count,
+//   chunk table of (id, 64-bit offset) ending in a zero id, then the chunks:
+//   PNAM sorted NUL-terminated .idx names, OIDF fanout, OIDL sorted OIDs,
+//   OOFF (pack id, 32-bit offset) per object, LOFF optional 64-bit offsets,
+//   and a SHA-1 of everything before it
+class MultiPackIndex {
+public:
+    explicit MultiPackIndex(const std::string& path) : file_(path) {
+        const unsigned char* data = file_.data();
+        size_t size = file_.size();
+
+        if (size < 12 + 20 || std::memcmp(data, "MIDX", 4) != 0) {
+            throw std::runtime_error("Not a multi-pack-index: " + path);
+        }
+        if (data[4] != 1) {
+            throw std::runtime_error("Unsupported multi-pack-index version: " + path);
+        }
+        if (data[5] != 1) {
+            throw std::runtime_error("Unsupported multi-pack-index hash version: " + path);
+        }
+        if (data[7] != 0) {
+            throw std::runtime_error("Incremental multi-pack-index chains are not supported: " + path);
+        }
+        unsigned chunkCount = data[6];
+        packCount_ = readBE32(data + 8);
+
+        size_t tableEnd = 12 + (static_cast<size_t>(chunkCount) + 1) * 12;
+        if (tableEnd > size - 20) {
+            throw std::runtime_error("Truncated multi-pack-index: " + path);
+        }
+        size_t packNamesSize = 0;
+        size_t fanoutSize = 0;
+        size_t largeOffsetsSize = 0;
+        for (unsigned i = 0; i < chunkCount; i++) {
+            const unsigned char* entry = data + 12 + i * 12;
+            uint32_t id = readBE32(entry);
+            uint64_t start = readBE64(entry + 4);
+            uint64_t end = readBE64(entry + 16);
+            if (start < tableEnd || end < start || end > size - 20) {
+                throw std::runtime_error("Corrupt chunk table in multi-pack-index: " + path);
+            }
+            const unsigned char* chunk = data + start;
+            size_t length = static_cast<size_t>(end - start);
+            switch (id) {
+                case midxChunkPackNames: packNames_ = chunk; packNamesSize = length; break;
+                case midxChunkOidFanout: fanout_ = chunk; fanoutSize = length; break;
+                case midxChunkOidLookup: oids_ = chunk; oidsSize_ = length; break;
+                case midxChunkObjectOffsets: offsets_ = chunk; offsetsSize_ = length; break;
+                case midxChunkLargeOffsets: largeOffsets_ = chunk; largeOffsetsSize = length; break;
+                default: break;    // unknown optional chunks (e.g. bitmaps' RIDX) are skipped
+            }
+        }
+
+        if (!packNames_ || !fanout_ || !oids_ || !offsets_ || fanoutSize != 256 * 4) {
+            throw std::runtime_error("Multi-pack-index is missing a required chunk: " + path);
+        }
+        count_ = readBE32(fanout_ + 255 * 4);
+        if (oidsSize_ != static_cast<size_t>(count_) * 20 || offsetsSize_ != static_cast<size_t>(count_) * 8) {
+            throw std::runtime_error("Multi-pack-index chunk sizes do not match its object count: " + path);
+        }
+        largeOffsetCount_ = largeOffsetsSize / 8;
+
+        size_t pos = 0;
+        for (uint32_t i = 0; i < packCount_; i++) {
+            const void* nul = pos < packNamesSize ? std::memchr(packNames_ + pos, '\0', packNamesSize - pos) : nullptr;
+            if (!nul) {
+                throw std::runtime_error("Corrupt pack name chunk in multi-pack-index: " + path);
+            }
+            size_t end = static_cast<const unsigned char*>(nul) - packNames_;
+            packNameList_.emplace_back(reinterpret_cast<const char*>(packNames_ + pos), end - pos);
+            pos = end + 1;
+        }
+    }
+
+    const std::string& path() const { return file_.path(); }
+    uint32_t objectCount() const { return count_; }
+
+    // .idx file names of the covered packs, in pack id order
+    const std::vector<std::string>& packNames() const { return packNameList_; }
+
+    const unsigned char* oidAt(uint32_t i) const { return oids_ + static_cast<size_t>(i) * 20; }
+    uint32_t fanoutAt(unsigned byte) const { return readBE32(fanout_ + byte * 4); }
+    uint32_t packIdAt(uint32_t i) const { return readBE32(offsets_ + static_cast<size_t>(i) * 8); }
+
+    uint64_t offsetAt(uint32_t i) const {
+        uint32_t offset = readBE32(offsets_ + static_cast<size_t>(i) * 8 + 4);
+        if (!largeOffsets_ || (offset & midxLargeOffsetNeeded) == 0) {
+            return offset;
+        }
+        uint32_t largeIndex = offset & ~midxLargeOffsetNeeded;
+        if (largeIndex >= largeOffsetCount_) {
+            throw std::runtime_error("Corrupt 64-bit offset in multi-pack-index: " + path());
+        }
+        return readBE64(largeOffsets_ + static_cast<size_t>(largeIndex) * 8);
+    }
+
+    bool find(const unsigned char* oid, uint32_t& position) const {
+        uint32_t lo = oid[0] == 0 ? 0 : fanoutAt(oid[0] - 1);
+        uint32_t hi = fanoutAt(oid[0]);
+
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            int cmp = std::memcmp(oidAt(mid), oid, 20);
+            if (cmp == 0) {
+                position = mid;
+                return true;
+            }
+            if (cmp < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return false;
+    }
+
+    bool checksumMatches() const {
+        unsigned char checksum[20];
+        Sha1Context ctx;
+        ctx.update(file_.data(), file_.size() - 20);
+        ctx.final(checksum);
+        return std::memcmp(checksum, file_.data() + file_.size() - 20, 20) == 0;
+    }
+
+private:
+    MappedFile file_;
+    const unsigned char* packNames_ = nullptr;
+    const unsigned char* fanout_ = nullptr;
+    const unsigned char* oids_ = nullptr;
+    const unsigned char* offsets_ = nullptr;
+    const unsigned char* largeOffsets_ = nullptr;
+    size_t oidsSize_ = 0;
+    size_t offsetsSize_ = 0;
+    size_t largeOffsetCount_ = 0;
+    uint32_t count_ = 0;
+    uint32_t packCount_ = 0;
+    std::vector<std::string> packNameList_;
+};
+
+// .idx names of the complete packs in packDir, sorted as the PNAM chunk wants them
+std::vector<std::string> listPackIndexes(const std::string& packDir) {
+    std::vector<std::string> names;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(packDir, ec)) {
+        std::string name = entry.path().filename().string();
+        // tmp_* files are packs still being written
+        if (entry.path().extension() != ".idx" || name.rfind("tmp_", 0) == 0) {
+            continue;
+        }
+        std::filesystem::path packPath = entry.path();
+        if (std::filesystem::exists(packPath.replace_extension(".pack"))) {
+            names.push_back(name);
+        }
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+// Write packDir/multi-pack-index covering every pack in packDir and return the
+// number of objects it lists. An object stored in several packs is taken from
+// the most recently modified one, as git does.
+size_t writeMultiPackIndex(const std::string& packDir) {
+    std::vector<std::string> packNames = listPackIndexes(packDir);
+    std::vector<std::unique_ptr<PackIndex>> indexes;
+    std::vector<int64_t> mtimes;
+    for (const auto& name : packNames) {
+        std::string packPath = packDir + "/" + name.substr(0, name.size() - 4) + ".pack";
+        indexes.push_back(std::make_unique<PackIndex>(packDir + "/" + name));
+        struct stat st {};
+        stat(packPath.c_str(), &st);
+        mtimes.push_back(static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec);
+    }
+
+    struct Object {
+        const unsigned char* oid;
+        uint32_t packId;
+        uint64_t offset;
+    };
+    std::vector<Object> objects;
+    size_t total = 0;
+    for (const auto& index : indexes) {
+        total += index->objectCount();
+    }
+    objects.reserve(total);
+    for (uint32_t packId = 0; packId < indexes.size(); packId++) {
+        const PackIndex& index = *indexes[packId];
+        for (uint32_t i = 0; i < index.objectCount(); i++) {
+            objects.push_back({index.oidAt(i), packId, index.offsetAt(i)});
+        }
+    }
+    std::sort(objects.begin(), objects.end(), [&mtimes](const Object& a, const Object& b) {
+        int cmp = std::memcmp(a.oid, b.oid, 20);
+        if (cmp != 0) {
+            return cmp < 0;
+        }
+        if (mtimes[a.packId] != mtimes[b.packId]) {
+            return mtimes[a.packId] > mtimes[b.packId];
+        }
+        return a.packId < b.packId;
+    });
+    objects.erase(std::unique(objects.begin(), objects.end(),
+                              [](const Object& a, const Object& b) { return std::memcmp(a.oid, b.oid, 20) == 0; }),
+                  objects.end());
+
+    // 64-bit offsets are only needed once one does not fit in 32 bits; then every
+    // offset of 2^31 and up moves to LOFF, since OOFF keeps only 31 bits for it
+    bool largeOffsetsNeeded = std::any_of(objects.begin(), objects.end(),
+                                          [](const Object& o) { return o.offset > 0xFFFFFFFFu; });
+
+    std::string packNamesChunk;
+    for (const auto& name : packNames) {
+        packNamesChunk.append(name);
+        packNamesChunk.push_back('\0');
+    }
+    packNamesChunk.append((4 - packNamesChunk.size() % 4) % 4, '\0');
+
+    std::string fanoutChunk;
+    uint32_t fanout[256] = {};
+    for (const auto& object : objects) {
+        fanout[object.oid[0]]++;
+    }
+    uint32_t running = 0;
+    for (int i = 0; i < 256; i++) {
+        running += fanout[i];
+        appendBE32(fanoutChunk, running);
+    }
+
+    std::string oidChunk;
+    std::string offsetChunk;
+    std::string largeOffsetChunk;
+    oidChunk.reserve(objects.size() * 20);
+    offsetChunk.reserve(objects.size() * 8);
+    for (const auto& object : objects) {
+        oidChunk.append(reinterpret_cast<const char*>(object.oid), 20);
+        appendBE32(offsetChunk, object.packId);
+        if (largeOffsetsNeeded && (object.offset >> 31) != 0) {
+            appendBE32(offsetChunk, midxLargeOffsetNeeded | static_cast<uint32_t>(largeOffsetChunk.size() / 8));
+            appendBE32(largeOffsetChunk, static_cast<uint32_t>(object.offset >> 32));
+            appendBE32(largeOffsetChunk, static_cast<uint32_t>(object.offset));
+        } else {
+            appendBE32(offsetChunk, static_cast<uint32_t>(object.offset));
+        }
+    }
+
+    std::vector<std::pair<uint32_t, const std::string*>> chunks = {
+        {midxChunkPackNames, &packNamesChunk},
+        {midxChunkOidFanout, &fanoutChunk},
+        {midxChunkOidLookup, &oidChunk},
+        {midxChunkObjectOffsets, &offsetChunk},
+    };
+    if (largeOffsetsNeeded) {
+        chunks.push_back({midxChunkLargeOffsets, &largeOffsetChunk});
+    }
+
+    std::string out = "MIDX";
+    out.push_back(1);    // version
+    out.push_back(1);    // SHA-1
+    out.push_back(static_cast<char>(chunks.size()));
+    out.push_back(0);    // no base multi-pack-index
+    appendBE32(out, static_cast<uint32_t>(packNames.size()));
+
+    uint64_t offset = 12 + (chunks.size() + 1) * 12;
+    auto appendChunkEntry = [&out](uint32_t id, uint64_t start) {
+        appendBE32(out, id);
+        appendBE32(out, static_cast<uint32_t>(start >> 32));
+        appendBE32(out, static_cast<uint32_t>(start));
+    };
+    for (const auto& [id, chunk] : chunks) {
+        appendChunkEntry(id, offset);
+        offset += chunk->size();
+    }
+    appendChunkEntry(0, offset);
+    for (const auto& chunk : chunks) {
+        out.append(*chunk.second);
+    }
+
+    unsigned char checksum[20];
+    Sha1Context ctx;
+    ctx.update(out.data(), out.size());
+    ctx.final(checksum);
+    out.append(reinterpret_cast<const char*>(checksum), 20);
+
+    std::string path = packDir + "/multi-pack-index";
+    std::string lockPath = path + ".lock";
+    {
+        std::ofstream file(lockPath, std::ios::binary | std::ios::trunc);
+        file.write(out.data(), static_cast<std::streamsize>(out.size()));
+        if (!file) {
+            throw std::runtime_error("Failed to write " + lockPath);
+        }
+    }
+
+    // Read the new file back before it replaces the old one: every object must
+    // come back with the pack and offset it was written with
+    try {
+        MultiPackIndex written(lockPath);
+        if (written.objectCount() != objects.size()) {
+            throw std::runtime_error("multi-pack-index lists the wrong number of objects");
+        }
+        for (uint32_t i = 0; i < written.objectCount(); i++) {
+            if (written.packIdAt(i) != objects[i].packId || written.offsetAt(i) != objects[i].offset) {
+                throw std::runtime_error("multi-pack-index does not read back the offset of " +
+                                         oidToHex(objects[i].oid));
+            }
+        }
+    } catch (...) {
+        std::filesystem::remove(lockPath);
+        throw;
+    }
+    std::filesystem::rename(lockPath, path);
+    return objects.size();
+}
+
+// Check packDir/multi-pack-index against the packs it lists: its checksum,
+// OID order and fanout, and that every object of every pack is found at the
+// offset the pack's own index gives. Throws on the first problem; returns the
+// number of objects checked.
+size_t verifyMultiPackIndex(const std::string& packDir) {
+    MultiPackIndex midx(packDir + "/multi-pack-index");
+    if (!midx.checksumMatches()) {
+        throw std::runtime_error("multi-pack-index checksum mismatch");
+    }
+
+    const auto& names = midx.packNames();
+    for (size_t i = 1; i < names.size(); i++) {
+        if (names[i - 1] >= names[i]) {
+            throw std::runtime_error("pack names out of order: '" + names[i - 1] + "' before '" + names[i] + "'");
+        }
+    }
+    std::vector<std::unique_ptr<PackIndex>> indexes;
+    for (const auto& name : names) {
+        indexes.push_back(std::make_unique<PackIndex>(packDir + "/" + name));
+    }
+
+    for (unsigned byte = 1; byte < 256; byte++) {
+        if (midx.fanoutAt(byte) < midx.fanoutAt(byte - 1)) {
+            throw std::runtime_error("fanout is not monotonic at " + std::to_string(byte));
+        }
+    }
+    for (uint32_t i = 0; i < midx.objectCount(); i++) {
+        const unsigned char* oid = midx.oidAt(i);
+        if (i > 0 && std::memcmp(midx.oidAt(i - 1), oid, 20) >= 0) {
+            throw std::runtime_error("object ids out of order at position " + std::to_string(i));
+        }
+        uint32_t lo = oid[0] == 0 ? 0 : midx.fanoutAt(oid[0] - 1);
+        if (i < lo || i >= midx.fanoutAt(oid[0])) {
+            throw std::runtime_error("fanout does not cover " + oidToHex(oid));
+        }
+
+        uint32_t packId = midx.packIdAt(i);
+        uint32_t position;
+        if (packId >= indexes.size() || !indexes[packId]->find(oid, position)) {
+            throw std::runtime_error("object " + oidToHex(oid) + " is not in the pack the index names");
+        }
+        if (indexes[packId]->offsetAt(position) != midx.offsetAt(i)) {
+            throw std::runtime_error("wrong offset for object " + oidToHex(oid) + " in " + names[packId]);
+        }
+    }
+
+    for (size_t packId = 0; packId < indexes.size(); packId++) {
+        const PackIndex& index = *indexes[packId];
+        for (uint32_t i = 0; i < index.objectCount(); i++) {
+            uint32_t position;
+            if (!midx.find(index.oidAt(i), position)) {
+                throw std::runtime_error("object " + oidToHex(index.oidAt(i)) + " from " + names[packId] +
+                                         " is missing");
+            }
+        }
+    }
+    return midx.objectCount();
+}
+
+#endif
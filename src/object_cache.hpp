@@ -0,0 +1,109 @@
+#ifndef OBJECT_CACHE
+#define OBJECT_CACHE
+
+#include <string>
+#include <memory>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <cstdint>
+#include "object_id.hpp"
+
+// Inflated objects in "type size\0content" form keyed by binary OID, so walks
+// that keep coming back to the same trees and commits skip the inflate and
+// delta work. The budget is split over independently locked shards picked by
+// the OID's first byte, so concurrent readers rarely wait on each other; each
+// shard evicts least recently used objects once it is over its share.
+class ObjectCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;       // cacheable objects that had to be read and inflated
+        uint64_t evictions = 0;
+        size_t bytes = 0;
+        size_t entries = 0;
+    };
+
+    explicit ObjectCache(size_t limit = 64 * 1024 * 1024, unsigned shardCount = 16)
+        : limit_(limit), shardCount_(shardCount), shards_(std::make_unique<Shard[]>(shardCount)) {}
+
+    size_t limit() const { return limit_; }
+
+    std::shared_ptr<const std::string> get(const ObjectId& oid) {
+        if (limit_ == 0) {
+            return nullptr;
+        }
+        Shard& shard = shardFor(oid);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.map.find(oid);
+        if (it == shard.map.end()) {
+            return nullptr;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return it->second->object;
+    }
+
+    // Remember an object just read after a get() missed it
+    void put(const ObjectId& oid, std::shared_ptr<const std::string> object) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        // One object may not take more than a quarter of its shard
+        size_t shardLimit = limit_ / shardCount_;
+        if (object->size() > shardLimit / 4) {
+            return;
+        }
+        Shard& shard = shardFor(oid);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.map.count(oid)) {
+            return;
+        }
+        shard.used += object->size();
+        shard.lru.push_front({oid, std::move(object)});
+        shard.map[oid] = shard.lru.begin();
+
+        while (shard.used > shardLimit && !shard.lru.empty()) {
+            shard.used -= shard.lru.back().object->size();
+            shard.map.erase(shard.lru.back().key);
+            shard.lru.pop_back();
+            shard.evictions++;
+        }
+    }
+
+    Stats stats() const {
+        Stats stats;
+        stats.hits = hits_.load(std::memory_order_relaxed);
+        stats.misses = misses_.load(std::memory_order_relaxed);
+        for (unsigned i = 0; i < shardCount_; i++) {
+            std::lock_guard<std::mutex> lock(shards_[i].mutex);
+            stats.evictions += shards_[i].evictions;
+            stats.bytes += shards_[i].used;
+            stats.entries += shards_[i].map.size();
+        }
+        return stats;
+    }
+
+private:
+    struct Entry {
+        ObjectId key;
+        std::shared_ptr<const std::string> object;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> lru;
+        std::unordered_map<ObjectId, std::list<Entry>::iterator, ObjectIdHash> map;
+        size_t used = 0;
+        uint64_t evictions = 0;
+    };
+
+    Shard& shardFor(const ObjectId& oid) { return shards_[oid.bytes[0] % shardCount_]; }
+
+    size_t limit_;
+    unsigned shardCount_;
+    std::unique_ptr<Shard[]> shards_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+};
+
+#endif
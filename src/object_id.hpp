@@ -0,0 +1,107 @@
+#ifndef OBJECT_ID
+#define OBJECT_ID
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <ostream>
+#include <compare>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+#include "hex.hpp"
+
+// A SHA-1 object id as its 20 raw bytes. Trivially copyable and ordered like
+// the raw bytes (which is also the order of the hex form), so it can key maps
+// and sorted tables without the allocation a 40-character string costs.
+struct ObjectId {
+    static constexpr size_t rawSize = 20;
+    static constexpr size_t hexSize = 40;
+
+    std::array<unsigned char, rawSize> bytes{};
+
+    static constexpr ObjectId fromRaw(const unsigned char* raw) {
+        ObjectId oid;
+        for (size_t i = 0; i < rawSize; i++) {
+            oid.bytes[i] = raw[i];
+        }
+        return oid;
+    }
+
+    // False unless hex is exactly 40 hex digits (either case)
+    static constexpr bool parseHex(std::string_view hex, ObjectId& out) {
+        if (hex.size() != hexSize) {
+            return false;
+        }
+        if consteval {
+            return decodeHexScalar(hex.data(), rawSize, out.bytes.data());
+        } else {
+            return decodeHex(hex.data(), rawSize, out.bytes.data());
+        }
+    }
+
+    static constexpr ObjectId fromHex(std::string_view hex) {
+        ObjectId oid;
+        if (!parseHex(hex, oid)) {
+            throw std::runtime_error("Invalid object id: " + std::string(hex));
+        }
+        return oid;
+    }
+
+    // Write the 40 lowercase hex digits to out (not NUL-terminated)
+    constexpr void toHex(char* out) const {
+        if consteval {
+            encodeHexScalar(bytes.data(), rawSize, out);
+        } else {
+            encodeHex(bytes.data(), rawSize, out);
+        }
+    }
+
+    std::string hex() const {
+        std::string out(hexSize, '0');
+        toHex(out.data());
+        return out;
+    }
+
+    const unsigned char* data() const { return bytes.data(); }
+    unsigned char* data() { return bytes.data(); }
+
+    constexpr bool isNull() const {
+        for (unsigned char byte : bytes) {
+            if (byte != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    friend constexpr bool operator==(const ObjectId&, const ObjectId&) = default;
+    friend constexpr auto operator<=>(const ObjectId&, const ObjectId&) = default;
+};
+
+static_assert(std::is_trivially_copyable_v<ObjectId>);
+static_assert(sizeof(ObjectId) == ObjectId::rawSize);
+static_assert(ObjectId::fromHex("00000000000000000000000000000000000000ff").bytes[19] == 0xff);
+static_assert([] {
+    char hex[ObjectId::hexSize];
+    ObjectId::fromHex("0123456789abcdefABCDEF0123456789abcdef01").toHex(hex);
+    return std::string_view(hex, sizeof(hex)) == "0123456789abcdefabcdef0123456789abcdef01";
+}());
+
+// Object ids are uniformly distributed, so any eight of their bytes make a good hash
+struct ObjectIdHash {
+    size_t operator()(const ObjectId& oid) const noexcept {
+        uint64_t hash;
+        std::memcpy(&hash, oid.bytes.data() + 4, sizeof(hash));
+        return static_cast<size_t>(hash);
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& out, const ObjectId& oid) {
+    char hex[ObjectId::hexSize];
+    oid.toHex(hex);
+    return out.write(hex, sizeof(hex));
+}
+
+#endif
@@ -0,0 +1,804 @@
+#ifndef PACK
+#define PACK
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <fstream>
+#include <functional>
+#include <zlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "object_id.hpp"
+#include "sha1.hpp"
+
+// Object types as encoded in a pack entry header
+enum PackObjectType {
+    OBJ_COMMIT = 1,
+    OBJ_TREE = 2,
+    OBJ_BLOB = 3,
+    OBJ_TAG = 4,
+    OBJ_OFS_DELTA = 6,
+    OBJ_REF_DELTA = 7
+};
+
+std::string packTypeName(int type) {
+    switch (type) {
+        case OBJ_COMMIT: return "commit";
+        case OBJ_TREE: return "tree";
+        case OBJ_BLOB: return "blob";
+        case OBJ_TAG: return "tag";
+        default: return "unknown";
+    }
+}
+
+// Convert a 40-char hex object id into 20 raw bytes, false if it is not valid hex
+bool hexToOid(std::string_view hex, unsigned char* out) {
+    ObjectId oid;
+    if (!ObjectId::parseHex(hex, oid)) {
+        return false;
+    }
+    std::memcpy(out, oid.data(), ObjectId::rawSize);
+    return true;
+}
+
+std::string oidToHex(const unsigned char* oid) {
+    return ObjectId::fromRaw(oid).hex();
+}
+
+uint32_t readBE32(const unsigned char* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+uint64_t readBE64(const unsigned char* p) {
+    return (static_cast<uint64_t>(readBE32(p)) << 32) | readBE32(p + 4);
+}
+
+// Read-only mapping of a whole file, unmapped on destruction
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) : path_(path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open file: " + path);
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("Failed to stat file: " + path);
+        }
+
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void* mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Failed to mmap file: " + path);
+            }
+            data_ = static_cast<const unsigned char*>(mapped);
+        }
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (data_) {
+            munmap(const_cast<unsigned char*>(data_), size_);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* data() const { return data_; }
+    size_t size() const { return size_; }
+    const std::string& path() const { return path_; }
+
+private:
+    std::string path_;
+    const unsigned char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Memory-mapped pack index (.idx version 2). Layout:
+//   "\377tOc", version, 256-entry fanout, sorted OIDs, CRC32s,
+//   32-bit offsets, 64-bit offsets, pack checksum, index checksum
+class PackIndex {
+public:
+    explicit PackIndex(const std::string& path) : file_(path) {
+        const unsigned char* data = file_.data();
+        size_t size = file_.size();
+
+        if (size < 8 + 256 * 4 + 40 || std::memcmp(data, "\377tOc", 4) != 0) {
+            throw std::runtime_error("Unsupported pack index format: " + path);
+        }
+        if (readBE32(data + 4) != 2) {
+            throw std::runtime_error("Unsupported pack index version: " + path);
+        }
+
+        fanout_ = data + 8;
+        count_ = readBE32(fanout_ + 255 * 4);
+        oids_ = fanout_ + 256 * 4;
+        crcs_ = oids_ + static_cast<size_t>(count_) * 20;
+        offsets_ = crcs_ + static_cast<size_t>(count_) * 4;
+        largeOffsets_ = offsets_ + static_cast<size_t>(count_) * 4;
+
+        // Everything up to the 32-bit offset table must fit, the 64-bit table fills the rest
+        size_t minSize = 8 + 256 * 4 + static_cast<size_t>(count_) * 28 + 40;
+        if (size < minSize) {
+            throw std::runtime_error("Truncated pack index: " + path);
+        }
+        largeOffsetCount_ = (size - minSize) / 8;
+    }
+
+    uint32_t objectCount() const { return count_; }
+    const unsigned char* oidAt(uint32_t i) const { return oids_ + static_cast<size_t>(i) * 20; }
+    uint32_t crcAt(uint32_t i) const { return readBE32(crcs_ + static_cast<size_t>(i) * 4); }
+
+    uint64_t offsetAt(uint32_t i) const {
+        uint32_t offset = readBE32(offsets_ + static_cast<size_t>(i) * 4);
+        if ((offset & 0x80000000u) == 0) {
+            return offset;
+        }
+        uint32_t largeIndex = offset & 0x7FFFFFFFu;
+        if (largeIndex >= largeOffsetCount_) {
+            throw std::runtime_error("Corrupt 64-bit offset in pack index: " + file_.path());
+        }
+        return readBE64(largeOffsets_ + static_cast<size_t>(largeIndex) * 8);
+    }
+
+    // Checksum of the pack this index describes (first half of the trailer)
+    const unsigned char* packChecksum() const { return file_.data() + file_.size() - 40; }
+
+    // Locate a raw 20-byte OID: the fanout narrows the range, then binary search
+    bool find(const unsigned char* oid, uint32_t& position) const {
+        uint32_t lo = oid[0] == 0 ? 0 : readBE32(fanout_ + (oid[0] - 1) * 4);
+        uint32_t hi = readBE32(fanout_ + oid[0] * 4);
+
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            int cmp = std::memcmp(oidAt(mid), oid, 20);
+            if (cmp == 0) {
+                position = mid;
+                return true;
+            }
+            if (cmp < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return false;
+    }
+
+private:
+    MappedFile file_;
+    const unsigned char* fanout_ = nullptr;
+    const unsigned char* oids_ = nullptr;
+    const unsigned char* crcs_ = nullptr;
+    const unsigned char* offsets_ = nullptr;
+    const unsigned char* largeOffsets_ = nullptr;
+    uint32_t count_ = 0;
+    size_t largeOffsetCount_ = 0;
+};
+
+// Parse the size varints at the start of delta data (little-endian base-128)
+uint64_t readDeltaSize(const unsigned char* data, size_t length, size_t& pos) {
+    uint64_t result = 0;
+    int shift = 0;
+    unsigned char byte;
+    do {
+        if (pos >= length || shift > 63) {
+            throw std::runtime_error("Corrupt delta: truncated size");
+        }
+        byte = data[pos++];
+        result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return result;
+}
+
+// Apply git delta instructions to base. The delta starts with the base and result
+// sizes, followed by copy (high bit set: offset/size bytes selected by the low bits)
+// and insert (1-127 literal bytes) instructions.
+std::string applyDelta(std::string_view base, const unsigned char* delta, size_t deltaSize) {
+    size_t pos = 0;
+    uint64_t baseSize = readDeltaSize(delta, deltaSize, pos);
+    uint64_t resultSize = readDeltaSize(delta, deltaSize, pos);
+    if (baseSize != base.size()) {
+        throw std::runtime_error("Corrupt delta: base size mismatch");
+    }
+
+    std::string result;
+    result.resize(resultSize);
+    char* out = result.data();
+    size_t written = 0;
+
+    while (pos < deltaSize) {
+        unsigned char op = delta[pos++];
+        if (op & 0x80) {
+            uint64_t copyOffset = 0;
+            uint64_t copySize = 0;
+            for (int i = 0; i < 4; i++) {
+                if (op & (1 << i)) {
+                    if (pos >= deltaSize) {
+                        throw std::runtime_error("Corrupt delta: truncated copy");
+                    }
+                    copyOffset |= static_cast<uint64_t>(delta[pos++]) << (i * 8);
+                }
+            }
+            for (int i = 0; i < 3; i++) {
+                if (op & (0x10 << i)) {
+                    if (pos >= deltaSize) {
+                        throw std::runtime_error("Corrupt delta: truncated copy");
+                    }
+                    copySize |= static_cast<uint64_t>(delta[pos++]) << (i * 8);
+                }
+            }
+            if (copySize == 0) {
+                copySize = 0x10000;
+            }
+            if (copyOffset + copySize > base.size() || written + copySize > resultSize) {
+                throw std::runtime_error("Corrupt delta: copy out of range");
+            }
+            std::memcpy(out + written, base.data() + copyOffset, copySize);
+            written += copySize;
+        } else if (op != 0) {
+            if (pos + op > deltaSize || written + op > resultSize) {
+                throw std::runtime_error("Corrupt delta: insert out of range");
+            }
+            std::memcpy(out + written, delta + pos, op);
+            pos += op;
+            written += op;
+        } else {
+            throw std::runtime_error("Corrupt delta: reserved instruction");
+        }
+    }
+
+    if (written != resultSize) {
+        throw std::runtime_error("Corrupt delta: result size mismatch");
+    }
+    return result;
+}
+
+// LRU cache of inflated delta bases keyed by (pack, offset), bounded by the total
+// size of the cached objects so long chains are not re-inflated on every read
+class DeltaBaseCache {
+public:
+    explicit DeltaBaseCache(size_t limit = 96 * 1024 * 1024) : limit_(limit) {}
+
+    bool get(const void* pack, uint64_t offset, int& type, std::shared_ptr<const std::string>& content) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = map_.find({pack, offset});
+        if (it == map_.end()) {
+            return false;
+        }
+        lru_.splice(lru_.begin(), lru_, it->second);
+        type = it->second->type;
+        content = it->second->content;
+        return true;
+    }
+
+    void put(const void* pack, uint64_t offset, int type, std::shared_ptr<const std::string> content) {
+        if (content->size() > limit_) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        Key key{pack, offset};
+        if (map_.count(key)) {
+            return;
+        }
+        used_ += content->size();
+        lru_.push_front({key, type, std::move(content)});
+        map_[key] = lru_.begin();
+
+        while (used_ > limit_ && !lru_.empty()) {
+            used_ -= lru_.back().content->size();
+            map_.erase(lru_.back().key);
+            lru_.pop_back();
+        }
+    }
+
+    size_t limit() const { return limit_; }
+
+private:
+    using Key = std::pair<const void*, uint64_t>;
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return std::hash<const void*>()(key.first) ^ std::hash<uint64_t>()(key.second * 0x9E3779B97F4A7C15ull);
+        }
+    };
+
+    struct Entry {
+        Key key;
+        int type;
+        std::shared_ptr<const std::string> content;
+    };
+
+    std::mutex mutex_;
+    std::list<Entry> lru_;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> map_;
+    size_t used_ = 0;
+    size_t limit_;
+};
+
+// Inflate one zlib stream of a pack entry directly into an exactly-sized buffer.
+// zlib counts input and output in 32-bit uInts, so both are fed in windows of
+// at most UINT_MAX bytes and objects of 4 GiB and more inflate like any other.
+std::string inflatePackData(const unsigned char* data, size_t available, uint64_t size) {
+    std::string result(size, '\0');
+
+    z_stream strm{};
+    if (inflateInit(&strm) != Z_OK) {
+        throw std::runtime_error("Failed to initialize zlib decompression");
+    }
+
+    strm.next_in = const_cast<Bytef*>(data);
+    strm.next_out = reinterpret_cast<Bytef*>(result.data());
+    size_t inputLeft = available;
+    size_t outputLeft = result.size();
+    int ret = Z_OK;
+    while (ret == Z_OK) {
+        if (strm.avail_in == 0 && inputLeft > 0) {
+            strm.avail_in = static_cast<uInt>(std::min<size_t>(inputLeft, UINT_MAX));
+            inputLeft -= strm.avail_in;
+        }
+        if (strm.avail_out == 0 && outputLeft > 0) {
+            strm.avail_out = static_cast<uInt>(std::min<size_t>(outputLeft, UINT_MAX));
+            outputLeft -= strm.avail_out;
+        }
+        ret = inflate(&strm, Z_NO_FLUSH);
+    }
+    uint64_t produced = static_cast<uint64_t>(strm.next_out - reinterpret_cast<Bytef*>(result.data()));
+    inflateEnd(&strm);
+
+    if (ret != Z_STREAM_END || produced != size) {
+        throw std::runtime_error("Failed to inflate pack entry");
+    }
+    return result;
+}
+
+// Inflate no more than the first limit bytes of a pack entry's zlib stream,
+// e.g. the size varints at the start of a delta
+std::string inflatePackPrefix(const unsigned char* data, size_t available, size_t limit) {
+    std::string result(limit, '\0');
+
+    z_stream strm{};
+    if (inflateInit(&strm) != Z_OK) {
+        throw std::runtime_error("Failed to initialize zlib decompression");
+    }
+
+    strm.next_in = const_cast<Bytef*>(data);
+    strm.avail_in = static_cast<uInt>(std::min<size_t>(available, UINT_MAX));
+    strm.next_out = reinterpret_cast<Bytef*>(result.data());
+    strm.avail_out = static_cast<uInt>(result.size());
+
+    int ret = Z_OK;
+    while (strm.avail_out > 0 && ret == Z_OK) {
+        ret = inflate(&strm, Z_SYNC_FLUSH);
+    }
+    size_t produced = strm.total_out;
+    inflateEnd(&strm);
+
+    if (ret != Z_OK && ret != Z_STREAM_END) {
+        throw std::runtime_error("Failed to inflate pack entry");
+    }
+    result.resize(produced);
+    return result;
+}
+
+// Decoded pack entry header
+struct PackEntryHeader {
+    uint64_t offset;        // position of the entry header in the pack
+    int type;
+    uint64_t size;          // inflated size (for deltas, the size of the delta data)
+    size_t dataOffset;      // start of the zlib stream
+    uint64_t baseOffset;    // OFS_DELTA: absolute offset of the base entry
+    const unsigned char* baseOid; // REF_DELTA: raw OID of the base object
+};
+
+// Memory-mapped packfile paired with its index
+class Packfile {
+public:
+    Packfile(const std::string& packPath, const std::string& idxPath)
+        : index_(idxPath), pack_(packPath) {
+        const unsigned char* data = pack_.data();
+        size_t size = pack_.size();
+
+        if (size < 12 + 20 || std::memcmp(data, "PACK", 4) != 0) {
+            throw std::runtime_error("Invalid packfile: " + packPath);
+        }
+        uint32_t version = readBE32(data + 4);
+        if (version != 2 && version != 3) {
+            throw std::runtime_error("Unsupported packfile version: " + packPath);
+        }
+        if (readBE32(data + 8) != index_.objectCount()) {
+            throw std::runtime_error("Pack and index object counts differ: " + packPath);
+        }
+        if (std::memcmp(data + size - 20, index_.packChecksum(), 20) != 0) {
+            throw std::runtime_error("Pack checksum does not match index: " + packPath);
+        }
+    }
+
+    const PackIndex& index() const { return index_; }
+    const std::string& path() const { return pack_.path(); }
+
+    bool find(const unsigned char* oid, uint64_t& offset) const {
+        uint32_t position;
+        if (!index_.find(oid, position)) {
+            return false;
+        }
+        offset = index_.offsetAt(position);
+        return true;
+    }
+
+    PackEntryHeader readEntryHeader(uint64_t offset) const {
+        const unsigned char* data = pack_.data();
+        size_t end = pack_.size() - 20;
+        size_t pos = static_cast<size_t>(offset);
+        if (pos >= end) {
+            throw std::runtime_error("Pack offset out of range in " + path());
+        }
+
+        PackEntryHeader header{};
+        header.offset = offset;
+        unsigned char c = data[pos++];
+        header.type = (c >> 4) & 0x7;
+        header.size = c & 0x0F;
+        int shift = 4;
+        while (c & 0x80) {
+            if (pos >= end || shift > 57) {
+                throw std::runtime_error("Corrupt entry header in " + path());
+            }
+            c = data[pos++];
+            header.size |= static_cast<uint64_t>(c & 0x7F) << shift;
+            shift += 7;
+        }
+
+        if (header.type == OBJ_OFS_DELTA) {
+            // Negative offset, big-endian base-128 with an implicit +1 per continuation byte
+            if (pos >= end) {
+                throw std::runtime_error("Corrupt delta header in " + path());
+            }
+            c = data[pos++];
+            uint64_t distance = c & 0x7F;
+            while (c & 0x80) {
+                if (pos >= end) {
+                    throw std::runtime_error("Corrupt delta header in " + path());
+                }
+                c = data[pos++];
+                distance = ((distance + 1) << 7) | (c & 0x7F);
+            }
+            if (distance == 0 || distance > offset) {
+                throw std::runtime_error("Delta base offset out of range in " + path());
+            }
+            header.baseOffset = offset - distance;
+        } else if (header.type == OBJ_REF_DELTA) {
+            if (pos + 20 > end) {
+                throw std::runtime_error("Corrupt delta header in " + path());
+            }
+            header.baseOid = data + pos;
+            pos += 20;
+        }
+
+        header.dataOffset = pos;
+        return header;
+    }
+
+    // Inflate an entry's zlib stream straight out of the mapping into an exactly-sized buffer
+    std::string inflateEntry(const PackEntryHeader& header) const {
+        try {
+            return inflatePackData(pack_.data() + header.dataOffset, pack_.size() - 20 - header.dataOffset,
+                                   header.size);
+        } catch (const std::exception&) {
+            throw std::runtime_error("Failed to inflate pack entry in " + path());
+        }
+    }
+
+    // Read the object stored at offset, returning its type name and content.
+    // Delta chains are walked down to the nearest cached or full base and then
+    // applied base-first; intermediate results are offered to the cache.
+    void readObject(uint64_t offset, std::string& type, std::string& content, DeltaBaseCache* cache = nullptr) const {
+        std::vector<PackEntryHeader> chain;
+        std::shared_ptr<const std::string> base;
+        int baseType = 0;
+        uint64_t current = offset;
+
+        while (true) {
+            if (cache && cache->get(this, current, baseType, base)) {
+                break;
+            }
+
+            PackEntryHeader header = readEntryHeader(current);
+            if (header.type == OBJ_OFS_DELTA || header.type == OBJ_REF_DELTA) {
+                if (chain.size() >= index_.objectCount()) {
+                    throw std::runtime_error("Delta chain loop in " + path());
+                }
+                chain.push_back(header);
+                if (header.type == OBJ_OFS_DELTA) {
+                    current = header.baseOffset;
+                } else if (!find(header.baseOid, current)) {
+                    throw std::runtime_error("Delta base " + oidToHex(header.baseOid) + " missing from " + path());
+                }
+                continue;
+            }
+
+            if (packTypeName(header.type) == "unknown") {
+                throw std::runtime_error("Unknown object type in " + path());
+            }
+            baseType = header.type;
+            base = std::make_shared<const std::string>(inflateEntry(header));
+            if (cache && !chain.empty()) {
+                cache->put(this, current, baseType, base);
+            }
+            break;
+        }
+
+        for (size_t i = chain.size(); i-- > 0;) {
+            std::string delta = inflateEntry(chain[i]);
+            base = std::make_shared<const std::string>(
+                applyDelta(*base, reinterpret_cast<const unsigned char*>(delta.data()), delta.size()));
+            if (cache && i > 0) {
+                cache->put(this, chain[i].offset, baseType, base);
+            }
+        }
+
+        type = packTypeName(baseType);
+        content = *base;
+    }
+
+    // Type and size of the object stored at offset, without inflating it. A
+    // whole object's entry header carries both; a delta's result size is the
+    // second varint at the start of its data, and its type is the type of the
+    // base its chain ends at, found by reading entry headers only.
+    void readObjectHeader(uint64_t offset, std::string& type, uint64_t& size) const {
+        PackEntryHeader header = readEntryHeader(offset);
+        size = header.size;
+        if (header.type == OBJ_OFS_DELTA || header.type == OBJ_REF_DELTA) {
+            // Two varints of at most 10 bytes each
+            std::string sizes;
+            try {
+                sizes = inflatePackPrefix(pack_.data() + header.dataOffset, pack_.size() - 20 - header.dataOffset,
+                                          std::min<uint64_t>(header.size, 20));
+            } catch (const std::exception&) {
+                throw std::runtime_error("Failed to inflate pack entry in " + path());
+            }
+            const auto* data = reinterpret_cast<const unsigned char*>(sizes.data());
+            size_t pos = 0;
+            readDeltaSize(data, sizes.size(), pos);
+            size = readDeltaSize(data, sizes.size(), pos);
+        }
+
+        for (uint32_t depth = 0; header.type == OBJ_OFS_DELTA || header.type == OBJ_REF_DELTA; depth++) {
+            if (depth >= index_.objectCount()) {
+                throw std::runtime_error("Delta chain loop in " + path());
+            }
+            uint64_t base = header.baseOffset;
+            if (header.type == OBJ_REF_DELTA && !find(header.baseOid, base)) {
+                throw std::runtime_error("Delta base " + oidToHex(header.baseOid) + " missing from " + path());
+            }
+            header = readEntryHeader(base);
+        }
+
+        type = packTypeName(header.type);
+        if (type == "unknown") {
+            throw std::runtime_error("Unknown object type in " + path());
+        }
+    }
+
+    // Pass the content of the object at offset to sink in pieces of at most
+    // chunkSize bytes, returning its type. A whole object is inflated straight
+    // out of the mapping a piece at a time, so its size does not matter; a
+    // delta's result has to be built in memory and is handed on from there.
+    std::string streamObject(uint64_t offset, const std::function<void(std::string_view)>& sink,
+                             DeltaBaseCache* cache = nullptr, size_t chunkSize = 128 * 1024) const {
+        PackEntryHeader header = readEntryHeader(offset);
+        if (header.type == OBJ_OFS_DELTA || header.type == OBJ_REF_DELTA) {
+            std::string type;
+            std::string content;
+            readObject(offset, type, content, cache);
+            for (size_t pos = 0; pos < content.size(); pos += chunkSize) {
+                sink(std::string_view(content).substr(pos, chunkSize));
+            }
+            return type;
+        }
+        std::string type = packTypeName(header.type);
+        if (type == "unknown") {
+            throw std::runtime_error("Unknown object type in " + path());
+        }
+
+        z_stream strm{};
+        if (inflateInit(&strm) != Z_OK) {
+            throw std::runtime_error("Failed to initialize zlib decompression");
+        }
+        std::string buffer(chunkSize, '\0');
+        strm.next_in = const_cast<Bytef*>(pack_.data() + header.dataOffset);
+        size_t inputLeft = pack_.size() - 20 - header.dataOffset;
+        uint64_t produced = 0;
+        int ret = Z_OK;
+        try {
+            while (ret == Z_OK) {
+                if (strm.avail_in == 0 && inputLeft > 0) {
+                    strm.avail_in = static_cast<uInt>(std::min<size_t>(inputLeft, UINT_MAX));
+                    inputLeft -= strm.avail_in;
+                }
+                strm.next_out = reinterpret_cast<Bytef*>(buffer.data());
+                strm.avail_out = static_cast<uInt>(buffer.size());
+                ret = inflate(&strm, Z_NO_FLUSH);
+                size_t length = buffer.size() - strm.avail_out;
+                produced += length;
+                if (produced > header.size) {
+                    break;
+                }
+                if (length > 0) {
+                    sink(std::string_view(buffer.data(), length));
+                }
+            }
+        } catch (...) {
+            inflateEnd(&strm);
+            throw;
+        }
+        inflateEnd(&strm);
+        if (ret != Z_STREAM_END || produced != header.size) {
+            throw std::runtime_error("Failed to inflate pack entry in " + path());
+        }
+        return type;
+    }
+
+    // Raw bytes of the mapped pack, for copying entries verbatim into another pack
+    const unsigned char* data() const { return pack_.data(); }
+
+    // End of the entry at offset: the next entry's offset, or the start of the trailer
+    uint64_t entryEnd(uint64_t offset) const {
+        const auto& order = reverseIndex();
+        auto it = std::upper_bound(order.begin(), order.end(), std::make_pair(offset, UINT32_MAX));
+        return it == order.end() ? pack_.size() - 20 : it->first;
+    }
+
+    // OID of the entry starting at offset (e.g. an OFS_DELTA base)
+    bool oidAtOffset(uint64_t offset, const unsigned char*& oid) const {
+        const auto& order = reverseIndex();
+        auto it = std::lower_bound(order.begin(), order.end(), std::make_pair(offset, 0u));
+        if (it == order.end() || it->first != offset) {
+            return false;
+        }
+        oid = index_.oidAt(it->second);
+        return true;
+    }
+
+private:
+    // (offset, index position) pairs in pack order, built on first use
+    const std::vector<std::pair<uint64_t, uint32_t>>& reverseIndex() const {
+        std::call_once(reverseIndexOnce_, [this] {
+            reverseIndex_.reserve(index_.objectCount());
+            for (uint32_t i = 0; i < index_.objectCount(); i++) {
+                reverseIndex_.emplace_back(index_.offsetAt(i), i);
+            }
+            std::sort(reverseIndex_.begin(), reverseIndex_.end());
+        });
+        return reverseIndex_;
+    }
+
+    PackIndex index_;
+    MappedFile pack_;
+    mutable std::once_flag reverseIndexOnce_;
+    mutable std::vector<std::pair<uint64_t, uint32_t>> reverseIndex_;
+};
+
+// Pack entry header: type and size, 4 bits then 7 bits per continuation byte
+std::string encodePackEntryHeader(int type, uint64_t size) {
+    std::string header;
+    unsigned char c = static_cast<unsigned char>((type << 4) | (size & 0x0F));
+    size >>= 4;
+    while (size) {
+        header.push_back(static_cast<char>(c | 0x80));
+        c = size & 0x7F;
+        size >>= 7;
+    }
+    header.push_back(static_cast<char>(c));
+    return header;
+}
+
+// OFS_DELTA base distance: big-endian base-128 with an implicit +1 per continuation byte
+std::string encodeOffsetDelta(uint64_t distance) {
+    unsigned char buffer[16];
+    size_t pos = sizeof(buffer) - 1;
+    buffer[pos] = distance & 0x7F;
+    while (distance >>= 7) {
+        buffer[--pos] = 0x80 | (--distance & 0x7F);
+    }
+    return std::string(reinterpret_cast<const char*>(buffer + pos), sizeof(buffer) - pos);
+}
+
+// One object of a pack as recorded in its index
+struct PackIndexEntry {
+    unsigned char oid[20];
+    uint64_t offset;
+    uint32_t crc32;
+};
+
+void appendBE32(std::string& out, uint32_t value) {
+    out.push_back(static_cast<char>(value >> 24));
+    out.push_back(static_cast<char>(value >> 16));
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+// Write a version 2 .idx for a pack whose trailing checksum is packChecksum.
+// Sorts entries by OID; offsets that do not fit in 31 bits go to the 64-bit table.
+void writePackIndex(const std::string& idxPath, std::vector<PackIndexEntry>& entries,
+                    const unsigned char* packChecksum) {
+    std::sort(entries.begin(), entries.end(),
+              [](const PackIndexEntry& a, const PackIndexEntry& b) {
+                  return std::memcmp(a.oid, b.oid, 20) < 0;
+              });
+    for (size_t i = 1; i < entries.size(); i++) {
+        if (std::memcmp(entries[i - 1].oid, entries[i].oid, 20) == 0) {
+            throw std::runtime_error("Duplicate object in pack: " + oidToHex(entries[i].oid));
+        }
+    }
+
+    std::string idx;
+    idx.reserve(8 + 256 * 4 + entries.size() * 28 + 40);
+    idx.append("\377tOc", 4);
+    appendBE32(idx, 2);
+
+    uint32_t fanout[256] = {};
+    for (const auto& entry : entries) {
+        fanout[entry.oid[0]]++;
+    }
+    uint32_t running = 0;
+    for (int i = 0; i < 256; i++) {
+        running += fanout[i];
+        appendBE32(idx, running);
+    }
+
+    for (const auto& entry : entries) {
+        idx.append(reinterpret_cast<const char*>(entry.oid), 20);
+    }
+    for (const auto& entry : entries) {
+        appendBE32(idx, entry.crc32);
+    }
+
+    std::vector<uint64_t> largeOffsets;
+    for (const auto& entry : entries) {
+        if (entry.offset < 0x80000000u) {
+            appendBE32(idx, static_cast<uint32_t>(entry.offset));
+        } else {
+            appendBE32(idx, 0x80000000u | static_cast<uint32_t>(largeOffsets.size()));
+            largeOffsets.push_back(entry.offset);
+        }
+    }
+    for (uint64_t offset : largeOffsets) {
+        appendBE32(idx, static_cast<uint32_t>(offset >> 32));
+        appendBE32(idx, static_cast<uint32_t>(offset));
+    }
+
+    idx.append(reinterpret_cast<const char*>(packChecksum), 20);
+    ObjectId idxChecksum = sha1(idx.data(), idx.size());
+    idx.append(reinterpret_cast<const char*>(idxChecksum.data()), ObjectId::rawSize);
+
+    std::ofstream file(idxPath, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to create pack index: " + idxPath);
+    }
+    file.write(idx.data(), idx.size());
+    if (!file) {
+        throw std::runtime_error("Failed to write pack index: " + idxPath);
+    }
+}
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef PKT_LINE
+#define PKT_LINE
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+
+// Longest pkt-line allowed by the protocol, length prefix included
+constexpr size_t maxPktLength = 65520;
+
+// Encode one pkt-line: four hex digits of total length, then the payload
+std::string pktLine(std::string_view payload) {
+    if (payload.size() + 4 > maxPktLength) {
+        throw std::runtime_error("pkt-line payload too long");
+    }
+    static const char digits[] = "0123456789abcdef";
+    size_t length = payload.size() + 4;
+    std::string line(4, '0');
+    for (int i = 3; i >= 0; i--) {
+        line[i] = digits[length & 0xF];
+        length >>= 4;
+    }
+    line.append(payload);
+    return line;
+}
+
+const std::string pktFlush = "0000";
+const std::string pktDelim = "0001";
+
+enum class PktType { Data, Flush, Delim, ResponseEnd, Raw };
+
+// One packet, or a piece of one, as seen by the reader. The payload points into
+// the buffer passed to feed(), so nothing is copied; a packet that straddles feed()
+// calls arrives as several pieces, the first with begin set and the last with end set.
+// Raw pieces are unframed bytes after a bare "PACK" (v0 without side-band).
+struct PktLine {
+    PktType type;
+    std::string_view payload;
+    bool begin;
+    bool end;
+};
+
+// Incremental pkt-line reader: bytes are pushed in arbitrary chunks as they come
+// off the wire and packets are handed to the handler as they complete
+class PktLineReader {
+public:
+    using Handler = std::function<void(const PktLine&)>;
+
+    explicit PktLineReader(Handler handler) : handler_(std::move(handler)) {}
+
+    // Treat "PACK" where a length is expected as the start of an unframed pack
+    void setAllowRawPack(bool allow) { allowRawPack_ = allow; }
+
+    void feed(const char* data, size_t length) {
+        while (length > 0) {
+            if (raw_) {
+                handler_({PktType::Raw, std::string_view(data, length), false, false});
+                return;
+            }
+
+            if (remaining_ > 0) {
+                size_t take = std::min(length, remaining_);
+                remaining_ -= take;
+                bool begin = begin_;
+                begin_ = false;
+                handler_({PktType::Data, std::string_view(data, take), begin, remaining_ == 0});
+                data += take;
+                length -= take;
+                continue;
+            }
+
+            size_t take = std::min(length, 4 - prefixLength_);
+            std::memcpy(prefix_ + prefixLength_, data, take);
+            prefixLength_ += take;
+            data += take;
+            length -= take;
+            if (prefixLength_ < 4) {
+                continue;
+            }
+            prefixLength_ = 0;
+
+            if (allowRawPack_ && std::memcmp(prefix_, "PACK", 4) == 0) {
+                raw_ = true;
+                handler_({PktType::Raw, std::string_view(prefix_, 4), false, false});
+                continue;
+            }
+
+            size_t packetLength = parseLength();
+            if (packetLength == 0) {
+                handler_({PktType::Flush, {}, true, true});
+            } else if (packetLength == 1) {
+                handler_({PktType::Delim, {}, true, true});
+            } else if (packetLength == 2) {
+                handler_({PktType::ResponseEnd, {}, true, true});
+            } else if (packetLength < 4 || packetLength > maxPktLength) {
+                throw std::runtime_error("Invalid pkt-line length " + std::to_string(packetLength));
+            } else if (packetLength == 4) {
+                handler_({PktType::Data, {}, true, true});
+            } else {
+                remaining_ = packetLength - 4;
+                begin_ = true;
+            }
+        }
+    }
+
+    // True between packets, i.e. the stream may legitimately end here
+    bool atBoundary() const { return remaining_ == 0 && prefixLength_ == 0; }
+    bool inRawPack() const { return raw_; }
+
+private:
+    size_t parseLength() const {
+        size_t value = 0;
+        for (char c : prefix_) {
+            value <<= 4;
+            if (c >= '0' && c <= '9') value |= c - '0';
+            else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+            else throw std::runtime_error("Invalid pkt-line length prefix");
+        }
+        return value;
+    }
+
+    Handler handler_;
+    char prefix_[4];
+    size_t prefixLength_ = 0;
+    size_t remaining_ = 0;
+    bool begin_ = false;
+    bool allowRawPack_ = false;
+    bool raw_ = false;
+};
+
+// A complete packet from a fully buffered response
+struct PktPacket {
+    PktType type;
+    std::string payload;
+};
+
+// Split a fully buffered body (ref advertisement, ls-refs response) into packets
+std::vector<PktPacket> readPktLines(std::string_view body) {
+    std::vector<PktPacket> packets;
+    PktLineReader reader([&packets](const PktLine& pkt) {
+        if (pkt.begin) {
+            packets.push_back({pkt.type, ""});
+        }
+        packets.back().payload.append(pkt.payload);
+    });
+    reader.feed(body.data(), body.size());
+    if (!reader.atBoundary()) {
+        throw std::runtime_error("Truncated pkt-line response");
+    }
+    return packets;
+}
+
+// Routes an upload-pack response that uses side-band-64k. Band 1 goes to the pack
+// sink and band 2 (progress) to the progress sink, both as zero-copy spans; band 3
+// is a fatal error from the remote. Plain pkt-lines that precede the multiplexed
+// data (NAK, ACK, shallow, section headers) are collected and passed to the line
+// handler, and an unframed pack (v0 without side-band) goes to the pack sink too.
+class SideBandDemuxer {
+public:
+    using Sink = std::function<void(std::string_view)>;
+
+    SideBandDemuxer(Sink packSink, Sink progressSink)
+        : packSink_(std::move(packSink)), progressSink_(std::move(progressSink)),
+          reader_([this](const PktLine& pkt) { handle(pkt); }) {
+        reader_.setAllowRawPack(true);
+    }
+
+    SideBandDemuxer(const SideBandDemuxer&) = delete;
+    SideBandDemuxer& operator=(const SideBandDemuxer&) = delete;
+
+    // Called with each complete plain pkt-line, trailing newline included
+    void setLineHandler(Sink lineHandler) { lineHandler_ = std::move(lineHandler); }
+
+    void feed(const char* data, size_t length) { reader_.feed(data, length); }
+
+    bool packStarted() const { return packStarted_; }
+    bool atBoundary() const { return reader_.atBoundary(); }
+
+private:
+    void handle(const PktLine& pkt) {
+        if (pkt.type == PktType::Raw) {
+            packStarted_ = true;
+            packSink_(pkt.payload);
+            return;
+        }
+        if (pkt.type != PktType::Data) {
+            return;
+        }
+
+        std::string_view payload = pkt.payload;
+        if (pkt.begin) {
+            // The band byte can never start a text line, which tells the two apart
+            band_ = 0;
+            if (!payload.empty() && payload[0] >= 1 && payload[0] <= 3) {
+                band_ = payload[0];
+                payload.remove_prefix(1);
+            }
+            line_.clear();
+        }
+
+        switch (band_) {
+            case 1:
+                packStarted_ = true;
+                if (!payload.empty()) {
+                    packSink_(payload);
+                }
+                break;
+            case 2:
+                if (!payload.empty()) {
+                    progressSink_(payload);
+                }
+                break;
+            default:
+                // Band 3 and plain lines are short; only these are gathered
+                line_.append(payload);
+                if (pkt.end) {
+                    finishLine();
+                }
+                break;
+        }
+    }
+
+    void finishLine() {
+        if (band_ == 3) {
+            throw std::runtime_error("Remote error: " + line_);
+        }
+        if (line_.rfind("ERR ", 0) == 0) {
+            throw std::runtime_error("Remote error: " + line_.substr(4));
+        }
+        if (lineHandler_) {
+            lineHandler_(line_);
+        }
+    }
+
+    Sink packSink_;
+    Sink progressSink_;
+    Sink lineHandler_;
+    PktLineReader reader_;
+    std::string line_;
+    int band_ = 0;
+    bool packStarted_ = false;
+};
+
+#endif
@@ -0,0 +1,345 @@
+#ifndef PROTOCOL
+#define PROTOCOL
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <set>
+#include <stdexcept>
+#include <algorithm>
+#include "pkt_line.hpp"
+
+const std::string clientAgent = "git/2.0.0";
+
+// A ref as advertised by the remote
+struct RemoteRef {
+    std::string oid;
+    std::string name;
+    std::string symrefTarget;   // set for symbolic refs such as HEAD
+    std::string peeled;         // object an annotated tag points at
+};
+
+// What GET info/refs told us about the remote. For protocol v2 this is only the
+// capability list; refs are asked for with ls-refs. A v0 server advertises every
+// ref it has up front.
+struct RemoteAdvertisement {
+    int version = 0;
+    std::vector<std::string> capabilities;  // "name" or "name=value"
+    std::vector<RemoteRef> refs;            // v0 only
+
+    bool hasCapability(const std::string& name) const {
+        return std::any_of(capabilities.begin(), capabilities.end(), [&](const std::string& cap) {
+            return cap == name || cap.rfind(name + "=", 0) == 0;
+        });
+    }
+
+    std::string capabilityValue(const std::string& name) const {
+        for (const auto& cap : capabilities) {
+            if (cap.rfind(name + "=", 0) == 0) {
+                return cap.substr(name.size() + 1);
+            }
+        }
+        return "";
+    }
+
+    // v2 commands list their features in the value, e.g. "fetch=shallow filter"
+    bool commandSupports(const std::string& command, const std::string& feature) const {
+        std::string value = " " + capabilityValue(command) + " ";
+        return value.find(" " + feature + " ") != std::string::npos;
+    }
+};
+
+std::string stripNewline(std::string line) {
+    if (!line.empty() && line.back() == '\n') {
+        line.pop_back();
+    }
+    return line;
+}
+
+std::vector<std::string> splitSpaces(std::string_view text) {
+    std::vector<std::string> parts;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find(' ', pos);
+        if (end == std::string_view::npos) {
+            end = text.size();
+        }
+        if (end > pos) {
+            parts.emplace_back(text.substr(pos, end - pos));
+        }
+        pos = end + 1;
+    }
+    return parts;
+}
+
+// Parse the body of GET info/refs?service=git-upload-pack, sent with
+// "Git-Protocol: version=2". Servers that do not speak v2 answer with the v0
+// advertisement, which is parsed as well so the caller can fall back.
+RemoteAdvertisement parseRemoteAdvertisement(const std::string& body) {
+    std::vector<PktPacket> packets = readPktLines(body);
+    RemoteAdvertisement adv;
+
+    size_t i = 0;
+    // Smart HTTP prefixes the advertisement with "# service=..." and a flush
+    if (i < packets.size() && packets[i].type == PktType::Data && packets[i].payload.rfind("# service=", 0) == 0) {
+        i++;
+        if (i < packets.size() && packets[i].type == PktType::Flush) {
+            i++;
+        }
+    }
+
+    if (i < packets.size() && stripNewline(packets[i].payload) == "version 2") {
+        adv.version = 2;
+        for (i++; i < packets.size() && packets[i].type == PktType::Data; i++) {
+            adv.capabilities.push_back(stripNewline(packets[i].payload));
+        }
+        return adv;
+    }
+
+    for (bool first = true; i < packets.size() && packets[i].type == PktType::Data; i++, first = false) {
+        std::string line = stripNewline(packets[i].payload);
+        if (first) {
+            // Capabilities ride behind a NUL on the first ref line
+            size_t nul = line.find('\0');
+            if (nul != std::string::npos) {
+                adv.capabilities = splitSpaces(std::string_view(line).substr(nul + 1));
+                line.resize(nul);
+            }
+        }
+        size_t space = line.find(' ');
+        if (space != 40) {
+            throw std::runtime_error("Invalid ref advertisement line: " + line);
+        }
+        RemoteRef ref{line.substr(0, 40), line.substr(41), "", ""};
+        if (ref.name == "capabilities^{}") {
+            continue;   // empty repository
+        }
+        if (ref.name.size() > 3 && ref.name.compare(ref.name.size() - 3, 3, "^{}") == 0) {
+            if (!adv.refs.empty() && adv.refs.back().name + "^{}" == ref.name) {
+                adv.refs.back().peeled = ref.oid;
+            }
+            continue;
+        }
+        adv.refs.push_back(ref);
+    }
+
+    // v0 reports symbolic refs as "symref=HEAD:refs/heads/main" capabilities
+    for (const auto& cap : adv.capabilities) {
+        if (cap.rfind("symref=", 0) != 0) {
+            continue;
+        }
+        size_t colon = cap.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string source = cap.substr(7, colon - 7);
+        for (auto& ref : adv.refs) {
+            if (ref.name == source) {
+                ref.symrefTarget = cap.substr(colon + 1);
+            }
+        }
+    }
+    return adv;
+}
+
+// Capability lines every v2 command starts with
+std::string commandRequestHeader(const RemoteAdvertisement& adv, const std::string& command) {
+    std::string request = pktLine("command=" + command + "\n");
+    if (adv.hasCapability("agent")) {
+        request += pktLine("agent=" + clientAgent + "\n");
+    }
+    if (adv.hasCapability("object-format")) {
+        request += pktLine("object-format=sha1\n");
+    }
+    return request + pktDelim;
+}
+
+// ls-refs limited to the given prefixes, asking for symref targets and peeled tags
+std::string lsRefsRequest(const RemoteAdvertisement& adv, const std::vector<std::string>& prefixes) {
+    std::string request = commandRequestHeader(adv, "ls-refs");
+    request += pktLine("peel\n");
+    request += pktLine("symrefs\n");
+    for (const auto& prefix : prefixes) {
+        request += pktLine("ref-prefix " + prefix + "\n");
+    }
+    return request + pktFlush;
+}
+
+// Lines look like "<oid> <name>[ symref-target:<ref>][ peeled:<oid>]"
+std::vector<RemoteRef> parseLsRefsResponse(const std::string& body) {
+    std::vector<RemoteRef> refs;
+    for (const auto& packet : readPktLines(body)) {
+        if (packet.type != PktType::Data) {
+            continue;
+        }
+        std::string line = stripNewline(packet.payload);
+        if (line.rfind("ERR ", 0) == 0) {
+            throw std::runtime_error("Remote error: " + line.substr(4));
+        }
+        std::vector<std::string> parts = splitSpaces(line);
+        if (parts.size() < 2) {
+            throw std::runtime_error("Invalid ls-refs line: " + line);
+        }
+        if (parts[0] == "unborn") {
+            continue;
+        }
+        RemoteRef ref{parts[0], parts[1], "", ""};
+        for (size_t i = 2; i < parts.size(); i++) {
+            if (parts[i].rfind("symref-target:", 0) == 0) {
+                ref.symrefTarget = parts[i].substr(14);
+            } else if (parts[i].rfind("peeled:", 0) == 0) {
+                ref.peeled = parts[i].substr(7);
+            }
+        }
+        refs.push_back(ref);
+    }
+    return refs;
+}
+
+// Options that shape what a fetch sends back
+struct FetchOptions {
+    std::string filter;     // partial clone filter spec, e.g. "blob:none"
+    int depth = 0;          // shallow fetch: commits to keep per tip, 0 for full history
+    std::vector<std::string> haves;     // commits we have with everything they reach
+};
+
+// Shallow boundary changes announced by the server ahead of the pack
+struct ShallowInfo {
+    std::vector<std::string> shallow;       // commits whose parents we will not have
+    std::vector<std::string> unshallow;     // former boundary commits that now have parents
+
+    // Records "shallow <oid>" / "unshallow <oid>" lines, ignoring anything else
+    void parseLine(std::string_view line) {
+        std::string text = stripNewline(std::string(line));
+        if (text.rfind("shallow ", 0) == 0) {
+            shallow.push_back(text.substr(8));
+        } else if (text.rfind("unshallow ", 0) == 0) {
+            unshallow.push_back(text.substr(10));
+        }
+    }
+};
+
+// Accepts the filter specs we can promise to handle: blob:none and blob:limit=<n>[kmg]
+bool isValidFilterSpec(const std::string& spec) {
+    if (spec == "blob:none") {
+        return true;
+    }
+    if (spec.rfind("blob:limit=", 0) != 0) {
+        return false;
+    }
+    std::string limit = spec.substr(11);
+    if (!limit.empty() && std::string("kKmMgG").find(limit.back()) != std::string::npos) {
+        limit.pop_back();
+    }
+    return !limit.empty() && std::all_of(limit.begin(), limit.end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+// Whether the server will honour a filter line in this fetch
+bool serverSupportsFilter(const RemoteAdvertisement& adv) {
+    return adv.version == 2 ? adv.commandSupports("fetch", "filter") : adv.hasCapability("filter");
+}
+
+bool serverSupportsShallow(const RemoteAdvertisement& adv) {
+    return adv.version == 2 ? adv.commandSupports("fetch", "shallow") : adv.hasCapability("shallow");
+}
+
+// v2 fetch of the given tips; the response's packfile section is side-band multiplexed
+std::string fetchRequest(const RemoteAdvertisement& adv, const std::vector<std::string>& wants,
+                         const FetchOptions& options = {}) {
+    std::string request = commandRequestHeader(adv, "fetch");
+    request += pktLine("ofs-delta\n");
+    for (const auto& want : wants) {
+        request += pktLine("want " + want + "\n");
+    }
+    if (options.depth > 0) {
+        request += pktLine("deepen " + std::to_string(options.depth) + "\n");
+    }
+    if (!options.filter.empty()) {
+        request += pktLine("filter " + options.filter + "\n");
+    }
+    for (const auto& have : options.haves) {
+        request += pktLine("have " + have + "\n");
+    }
+    request += pktLine("done\n");
+    return request + pktFlush;
+}
+
+// v0 request: capabilities ride on the first want, and only those the server offered
+std::string uploadPackRequestV0(const RemoteAdvertisement& adv, const std::vector<std::string>& wants,
+                                const FetchOptions& options = {}) {
+    std::string capabilities;
+    for (const std::string cap : {"side-band-64k", "ofs-delta"}) {
+        if (adv.hasCapability(cap)) {
+            capabilities += " " + cap;
+        }
+    }
+    if (options.depth > 0) {
+        capabilities += " shallow";
+    }
+    if (!options.filter.empty()) {
+        capabilities += " filter";
+    }
+    if (adv.hasCapability("agent")) {
+        capabilities += " agent=" + clientAgent;
+    }
+
+    std::string request;
+    for (size_t i = 0; i < wants.size(); i++) {
+        request += pktLine("want " + wants[i] + (i == 0 ? capabilities : "") + "\n");
+    }
+    if (options.depth > 0) {
+        request += pktLine("deepen " + std::to_string(options.depth) + "\n");
+    }
+    if (!options.filter.empty()) {
+        request += pktLine("filter " + options.filter + "\n");
+    }
+    request += pktFlush;
+    for (const auto& have : options.haves) {
+        request += pktLine("have " + have + "\n");
+    }
+    return request + pktLine("done\n");
+}
+
+// Tips a clone needs: every advertised ref, each object once
+std::vector<std::string> cloneWants(const std::vector<RemoteRef>& refs) {
+    std::vector<std::string> wants;
+    std::set<std::string> seen;
+    for (const auto& ref : refs) {
+        if (seen.insert(ref.oid).second) {
+            wants.push_back(ref.oid);
+        }
+    }
+    return wants;
+}
+
+// The branch HEAD points at: the symref target when the server reports it,
+// otherwise a branch at the same commit, preferring main and master
+std::string remoteHeadBranch(const std::vector<RemoteRef>& refs) {
+    const RemoteRef* head = nullptr;
+    for (const auto& ref : refs) {
+        if (ref.name == "HEAD") {
+            head = &ref;
+        }
+    }
+    if (!head) {
+        return "";
+    }
+    if (!head->symrefTarget.empty()) {
+        return head->symrefTarget;
+    }
+    std::string match;
+    for (const auto& ref : refs) {
+        if (ref.oid != head->oid || ref.name.rfind("refs/heads/", 0) != 0) {
+            continue;
+        }
+        if (ref.name == "refs/heads/main" || ref.name == "refs/heads/master") {
+            return ref.name;
+        }
+        if (match.empty()) {
+            match = ref.name;
+        }
+    }
+    return match;
+}
+
+#endif
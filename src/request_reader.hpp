@@ -0,0 +1,93 @@
+#ifndef REQUEST_READER
+#define REQUEST_READER
+
+#include <string>
+#include <functional>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+
+// Lines read straight from a file descriptor, for commands that answer
+// requests as they arrive. Before a read would have to wait for the writer,
+// onIdle runs, so output can be held back while requests keep coming and
+// flushed the moment the other side pauses. Once stopFd becomes readable the
+// reader gives up waiting and reports end of input, which lets another thread
+// end a command that is blocked on a quiet writer.
+class RequestReader {
+public:
+    RequestReader(int fd, std::function<void()> onIdle, int stopFd = -1)
+        : fd_(fd), stopFd_(stopFd), onIdle_(std::move(onIdle)) {}
+
+    // Next line without its newline; false at end of input or once stopped
+    bool next(std::string& line) {
+        while (!stopped_) {
+            size_t newline = buffer_.find('\n', pos_);
+            if (newline != std::string::npos) {
+                line.assign(buffer_, pos_, newline - pos_);
+                pos_ = newline + 1;
+                return true;
+            }
+            if (eof_) {
+                if (pos_ == buffer_.size()) {
+                    return false;
+                }
+                line.assign(buffer_, pos_);
+                pos_ = buffer_.size();
+                return true;
+            }
+            buffer_.erase(0, pos_);
+            pos_ = 0;
+            fill();
+        }
+        return false;
+    }
+
+private:
+    void fill() {
+        struct pollfd pending[2] = {{fd_, POLLIN, 0}, {stopFd_, POLLIN, 0}};
+        nfds_t count = stopFd_ >= 0 ? 2 : 1;
+        if (onIdle_ && poll(pending, 1, 0) == 0) {
+            onIdle_();
+        }
+        if (stopFd_ >= 0) {
+            int ready;
+            do {
+                ready = poll(pending, count, -1);
+            } while (ready < 0 && errno == EINTR);
+            if (ready < 0) {
+                throw std::runtime_error(std::string("Failed to wait for input: ") + std::strerror(errno));
+            }
+            if (pending[1].revents != 0) {
+                stopped_ = true;
+                return;
+            }
+        }
+
+        size_t used = buffer_.size();
+        buffer_.resize(used + chunkSize);
+        ssize_t got;
+        do {
+            got = read(fd_, buffer_.data() + used, chunkSize);
+        } while (got < 0 && errno == EINTR);
+        if (got < 0) {
+            buffer_.resize(used);
+            throw std::runtime_error(std::string("Failed to read input: ") + std::strerror(errno));
+        }
+        buffer_.resize(used + got);
+        eof_ = got == 0;
+    }
+
+    static constexpr size_t chunkSize = 64 * 1024;
+
+    int fd_;
+    int stopFd_;
+    std::function<void()> onIdle_;
+    std::string buffer_;
+    size_t pos_ = 0;
+    bool eof_ = false;
+    bool stopped_ = false;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef TRANSPORT
+#define TRANSPORT
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <filesystem>
+#include <stdexcept>
+#include "util.hpp"
+#include "protocol.hpp"
+#include "upload_pack.hpp"
+
+// How clone and fetch reach a remote's upload-pack. Every transport speaks the
+// same pkt-line protocol; only the way requests and responses travel differs.
+class Transport {
+public:
+    virtual ~Transport() = default;
+
+    // URL recorded as remote.origin.url
+    virtual std::string url() const = 0;
+
+    // Capabilities (protocol v2) or the full ref advertisement (v0)
+    virtual RemoteAdvertisement discover() = 0;
+
+    // Send an upload-pack request and return the whole response (ls-refs)
+    virtual std::string request(const RemoteAdvertisement& adv, const std::string& body) = 0;
+
+    // Send an upload-pack request, handing the response to sink as it arrives (fetch)
+    virtual void streamRequest(const RemoteAdvertisement& adv, const std::string& body,
+                               const HTTPBodySink& sink) = 0;
+};
+
+// Git smart HTTP: GET info/refs, then POSTs to git-upload-pack
+class HttpTransport : public Transport {
+public:
+    explicit HttpTransport(std::string url) : url_(std::move(url)) {
+        while (!url_.empty() && url_.back() == '/') {
+            url_.pop_back();
+        }
+    }
+
+    std::string url() const override { return url_; }
+
+    // Asks for protocol v2; servers that do not know it answer with the v0 advertisement
+    RemoteAdvertisement discover() override {
+        std::string infoRefsUrl = url_ + "/info/refs?service=git-upload-pack";
+        std::cerr << "Requesting info/refs from: " << infoRefsUrl << std::endl;
+        HTTPResponse response = makeHTTPRequest(infoRefsUrl, "GET", "", {"Git-Protocol: version=2"});
+        if (response.status_code != 200) {
+            throw std::runtime_error("Failed to get info/refs: " + std::to_string(response.status_code) +
+                                     " - Response: " + response.body.substr(0, 200));
+        }
+        return parseRemoteAdvertisement(response.body);
+    }
+
+    std::string request(const RemoteAdvertisement& adv, const std::string& body) override {
+        HTTPResponse response = makeHTTPRequest(url_ + "/git-upload-pack", "POST", body, headers(adv));
+        if (response.status_code != 200) {
+            throw std::runtime_error("upload-pack request failed: " + std::to_string(response.status_code));
+        }
+        return response.body;
+    }
+
+    void streamRequest(const RemoteAdvertisement& adv, const std::string& body, const HTTPBodySink& sink) override {
+        HTTPResponse response = streamHTTPRequest(url_ + "/git-upload-pack", "POST", body, headers(adv), sink);
+        if (response.status_code != 200) {
+            throw std::runtime_error("Failed to fetch packfile: " + std::to_string(response.status_code) +
+                                     " - Response: " + response.body.substr(0, 200));
+        }
+    }
+
+private:
+    static std::vector<std::string> headers(const RemoteAdvertisement& adv) {
+        std::vector<std::string> headers = {
+            "Content-Type: application/x-git-upload-pack-request",
+            "Accept: application/x-git-upload-pack-result",
+            "User-Agent: " + clientAgent
+        };
+        if (adv.version == 2) {
+            headers.push_back("Git-Protocol: version=2");
+        }
+        return headers;
+    }
+
+    std::string url_;
+};
+
+// A repository on this machine, reached through file:// or a plain path. Requests
+// go to an in-process upload-pack reading the source's object store directly, so
+// a clone from a local mirror runs at disk speed and needs no network or server.
+class LocalTransport : public Transport {
+public:
+    explicit LocalTransport(const std::string& path)
+        : path_(std::filesystem::absolute(path).lexically_normal().string()), uploadPack_(findGitDir(path_)) {}
+
+    std::string url() const override { return path_; }
+
+    RemoteAdvertisement discover() override {
+        return parseRemoteAdvertisement(uploadPack_.advertisement());
+    }
+
+    std::string request(const RemoteAdvertisement&, const std::string& body) override {
+        std::string response;
+        uploadPack_.serve(body, [&response](std::string_view data) { response.append(data); });
+        return response;
+    }
+
+    void streamRequest(const RemoteAdvertisement&, const std::string& body, const HTTPBodySink& sink) override {
+        uploadPack_.serve(body, [&sink](std::string_view data) { sink(data.data(), data.size()); });
+    }
+
+private:
+    // A work tree's .git, or the directory itself for a bare repository
+    static std::string findGitDir(const std::string& path) {
+        std::filesystem::path dir(path);
+        if (std::filesystem::is_directory(dir / ".git")) {
+            return (dir / ".git").string();
+        }
+        if (std::filesystem::is_directory(dir / "objects") && std::filesystem::exists(dir / "HEAD")) {
+            return dir.string();
+        }
+        throw std::runtime_error("Not a git repository: " + path);
+    }
+
+    std::string path_;
+    UploadPack uploadPack_;
+};
+
+// Pick the transport for a URL: http(s):// is smart HTTP, file:// and existing
+// local paths are served in-process
+std::unique_ptr<Transport> openTransport(const std::string& url) {
+    if (url.rfind("http://", 0) == 0 || url.rfind("https://", 0) == 0) {
+        return std::make_unique<HttpTransport>(url);
+    }
+    if (url.rfind("file://", 0) == 0) {
+        return std::make_unique<LocalTransport>(url.substr(7));
+    }
+    if (url.find("://") == std::string::npos && std::filesystem::is_directory(url)) {
+        return std::make_unique<LocalTransport>(url);
+    }
+    throw std::runtime_error("Unsupported repository URL: " + url);
+}
+
+#endif
@@ -0,0 +1,488 @@
+#ifndef UPLOAD_PACK
+#define UPLOAD_PACK
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include <unordered_map>
+#include <deque>
+#include <functional>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include "util.hpp"
+#include "commit_walk.hpp"
+#include "pkt_line.hpp"
+#include "protocol.hpp"
+
+// Read one ref of the repository at gitDir, following symbolic refs; loose refs
+// win over packed-refs as in git
+bool readRepositoryRef(const std::string& gitDir, const std::string& name,
+                       const std::map<std::string, std::string>& packedRefs, std::string& oid, int depth = 0) {
+    if (depth > 5) {
+        return false;
+    }
+    std::ifstream file(gitDir + "/" + name);
+    std::string content;
+    if (file && std::getline(file, content)) {
+        if (content.rfind("ref: ", 0) == 0) {
+            return readRepositoryRef(gitDir, content.substr(5), packedRefs, oid, depth + 1);
+        }
+        oid = content.substr(0, 40);
+        return oid.size() == 40;
+    }
+    auto it = packedRefs.find(name);
+    if (it == packedRefs.end()) {
+        return false;
+    }
+    oid = it->second;
+    return true;
+}
+
+// HEAD plus everything under refs/, loose and packed, sorted by name
+std::vector<RemoteRef> readRepositoryRefs(const std::string& gitDir) {
+    std::map<std::string, std::string> packedRefs;
+    std::ifstream packed(gitDir + "/packed-refs");
+    std::string line;
+    while (std::getline(packed, line)) {
+        if (line.size() > 41 && line[0] != '#' && line[0] != '^') {
+            packedRefs[line.substr(41)] = line.substr(0, 40);
+        }
+    }
+
+    std::set<std::string> names;
+    for (const auto& entry : packedRefs) {
+        names.insert(entry.first);
+    }
+    std::error_code ec;
+    std::filesystem::path refsDir = std::filesystem::path(gitDir) / "refs";
+    for (auto it = std::filesystem::recursive_directory_iterator(refsDir, ec);
+         !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        if (it->is_regular_file()) {
+            names.insert(std::filesystem::relative(it->path(), gitDir).generic_string());
+        }
+    }
+
+    std::vector<RemoteRef> refs;
+    RemoteRef head{"", "HEAD", "", ""};
+    std::ifstream headFile(gitDir + "/HEAD");
+    std::string headContent;
+    if (headFile && std::getline(headFile, headContent)) {
+        if (headContent.rfind("ref: ", 0) == 0) {
+            head.symrefTarget = headContent.substr(5);
+        }
+        if (readRepositoryRef(gitDir, "HEAD", packedRefs, head.oid)) {
+            refs.push_back(head);
+        }
+    }
+
+    for (const auto& name : names) {
+        RemoteRef ref{"", name, "", ""};
+        if (readRepositoryRef(gitDir, name, packedRefs, ref.oid)) {
+            refs.push_back(ref);
+        }
+    }
+    return refs;
+}
+
+// Frames data as side-band-64k packets on its way to the sink. Data is gathered
+// behind a reserved length/band prefix that is filled in when the packet goes out.
+class SideBandWriter {
+public:
+    using Sink = std::function<void(std::string_view)>;
+
+    explicit SideBandWriter(const Sink& sink) : sink_(sink) {
+        packet_.reserve(maxPktLength);
+        packet_.assign("0000\1", 5);
+    }
+
+    void write(const void* data, size_t length) {
+        const char* bytes = static_cast<const char*>(data);
+        while (length > 0) {
+            size_t take = std::min(length, maxPktLength - packet_.size());
+            packet_.append(bytes, take);
+            bytes += take;
+            length -= take;
+            if (packet_.size() == maxPktLength) {
+                flush();
+            }
+        }
+    }
+
+    void flush() {
+        if (packet_.size() > 5) {
+            static const char digits[] = "0123456789abcdef";
+            size_t length = packet_.size();
+            for (int i = 3; i >= 0; i--) {
+                packet_[i] = digits[length & 0xF];
+                length >>= 4;
+            }
+            sink_(packet_);
+            packet_.resize(5);
+        }
+    }
+
+    void progress(const std::string& message) {
+        flush();
+        sink_(pktLine(std::string(1, '\2') + message));
+    }
+
+private:
+    const Sink& sink_;
+    std::string packet_;
+};
+
+// Protocol v2 upload-pack run in-process against a repository on disk. It serves
+// the ls-refs and fetch commands of the local transport; fetch enumerates the
+// objects reachable from the wants (honouring deepen and blob filters) and streams
+// a pack that reuses the source packs' compressed entries where it can.
+class UploadPack {
+public:
+    using Sink = std::function<void(std::string_view)>;
+
+    explicit UploadPack(const std::string& gitDir) : gitDir_(gitDir), store_(gitDir + "/objects") {}
+
+    // Capability advertisement, as a v2 server answers GET info/refs
+    std::string advertisement() const {
+        return pktLine("version 2\n") + pktLine("agent=" + clientAgent + "\n") + pktLine("ls-refs\n") +
+               pktLine("fetch=shallow filter\n") + pktLine("object-format=sha1\n") + pktFlush;
+    }
+
+    // Run one command request and write the response to sink
+    void serve(const std::string& request, const Sink& sink) {
+        std::string command;
+        std::vector<std::string> arguments;
+        bool inArguments = false;
+        for (const auto& packet : readPktLines(request)) {
+            if (packet.type == PktType::Delim) {
+                inArguments = true;
+            } else if (packet.type == PktType::Flush) {
+                break;
+            } else if (packet.type == PktType::Data) {
+                std::string line = stripNewline(packet.payload);
+                if (inArguments) {
+                    arguments.push_back(line);
+                } else if (line.rfind("command=", 0) == 0) {
+                    command = line.substr(8);
+                }
+            }
+        }
+
+        if (command == "ls-refs") {
+            lsRefs(arguments, sink);
+        } else if (command == "fetch") {
+            fetch(arguments, sink);
+        } else {
+            sink(pktLine("ERR unknown command '" + command + "'\n"));
+        }
+    }
+
+private:
+    void lsRefs(const std::vector<std::string>& arguments, const Sink& sink) {
+        bool peel = false;
+        bool symrefs = false;
+        std::vector<std::string> prefixes;
+        for (const auto& argument : arguments) {
+            if (argument == "peel") {
+                peel = true;
+            } else if (argument == "symrefs") {
+                symrefs = true;
+            } else if (argument.rfind("ref-prefix ", 0) == 0) {
+                prefixes.push_back(argument.substr(11));
+            }
+        }
+
+        for (const auto& ref : readRepositoryRefs(gitDir_)) {
+            bool wanted = prefixes.empty() || std::any_of(prefixes.begin(), prefixes.end(), [&](const std::string& p) {
+                return ref.name.rfind(p, 0) == 0;
+            });
+            if (!wanted) {
+                continue;
+            }
+            std::string line = ref.oid + " " + ref.name;
+            if (symrefs && !ref.symrefTarget.empty()) {
+                line += " symref-target:" + ref.symrefTarget;
+            }
+            if (peel && ref.name.rfind("refs/tags/", 0) == 0) {
+                std::string objectData = store_.readObject(ref.oid);
+                if (objectData.compare(0, 4, "tag ") == 0) {
+                    line += " peeled:" + peelTag(ref.oid);
+                }
+            }
+            sink(pktLine(line + "\n"));
+        }
+        sink(pktFlush);
+    }
+
+    void fetch(const std::vector<std::string>& arguments, const Sink& sink) {
+        std::vector<std::string> wants;
+        int depth = 0;
+        std::string filter;
+        for (const auto& argument : arguments) {
+            if (argument.rfind("want ", 0) == 0) {
+                wants.push_back(argument.substr(5));
+            } else if (argument.rfind("deepen ", 0) == 0) {
+                uint64_t value;
+                if (!parseUnsigned(argument.substr(7), value) || value == 0 || value > INT_MAX) {
+                    sink(pktLine("ERR invalid deepen '" + argument.substr(7) + "'\n"));
+                    return;
+                }
+                depth = static_cast<int>(value);
+            } else if (argument.rfind("filter ", 0) == 0) {
+                filter = argument.substr(7);
+                if (!isValidFilterSpec(filter)) {
+                    sink(pktLine("ERR unsupported filter '" + filter + "'\n"));
+                    return;
+                }
+            }
+        }
+
+        objects_.clear();
+        included_.clear();
+        shallow_.clear();
+        try {
+            collectObjects(wants, depth, filter);
+        } catch (const std::exception& e) {
+            sink(pktLine(std::string("ERR ") + e.what() + "\n"));
+            return;
+        }
+
+        // A shallow source passes its own boundary on even without deepen
+        if (depth > 0 || !shallow_.empty()) {
+            sink(pktLine("shallow-info\n"));
+            for (const auto& oid : shallow_) {
+                sink(pktLine("shallow " + oid.hex() + "\n"));
+            }
+            sink(pktDelim);
+        }
+        sink(pktLine("packfile\n"));
+        SideBandWriter out(sink);
+        out.progress("Enumerating objects: " + std::to_string(objects_.size()) + ", done.\n");
+        writePack(out);
+        out.flush();
+        sink(pktFlush);
+    }
+
+    std::string peelTag(std::string oid) {
+        std::string objectData = store_.readObject(oid);
+        while (objectData.compare(0, 4, "tag ") == 0) {
+            size_t objectLine = objectData.find("object ", objectData.find('\0'));
+            if (objectLine == std::string::npos) {
+                throw std::runtime_error("Invalid tag object " + oid);
+            }
+            oid = objectData.substr(objectLine + 7, 40);
+            objectData = store_.readObject(oid);
+        }
+        return oid;
+    }
+
+    // Objects go out commits first, then tags, trees and blobs, as git orders them
+    void collectObjects(const std::vector<std::string>& wants, int depth, const std::string& filter) {
+        std::vector<ObjectId> commits, tags, trees, blobs;
+        std::deque<std::pair<ObjectId, int>> commitQueue;
+        std::unordered_set<ObjectId, ObjectIdHash> sourceShallow;
+        for (const auto& oid : readShallowFile(gitDir_)) {
+            sourceShallow.insert(ObjectId::fromHex(oid));
+        }
+
+        bool omitBlobs = filter == "blob:none";
+        // blob:limit=<n> leaves out blobs of n bytes and more, so a limit of 0 leaves out all of them
+        bool hasBlobLimit = filter.rfind("blob:limit=", 0) == 0;
+        uint64_t blobLimit = 0;
+        if (hasBlobLimit && !parseSizeWithUnit(filter.substr(11), blobLimit)) {
+            throw std::runtime_error("invalid filter '" + filter + "'");
+        }
+
+        auto addTree = [&](const ObjectId& root) {
+            std::vector<ObjectId> pending = {root};
+            while (!pending.empty()) {
+                ObjectId tree = pending.back();
+                pending.pop_back();
+                if (!included_.insert(tree).second) {
+                    continue;
+                }
+                trees.push_back(tree);
+                for (const auto& entry : parseTreeObject(store_.readObject(tree))) {
+                    if (entry.mode == "40000" || entry.mode == "040000") {
+                        pending.push_back(entry.oid);
+                    } else if (entry.mode == "160000") {
+                        continue;   // submodule commit, not in this repository
+                    } else if (!included_.count(entry.oid) && !omitBlobs &&
+                               (!hasBlobLimit || objectSize(entry.oid) < blobLimit)) {
+                        included_.insert(entry.oid);
+                        blobs.push_back(entry.oid);
+                    }
+                }
+            }
+        };
+
+        for (const auto& want : wants) {
+            ObjectId oid;
+            if (!ObjectId::parseHex(want, oid)) {
+                throw std::runtime_error("invalid want '" + want + "'");
+            }
+            std::string objectData = store_.readObject(oid);
+            // Annotated tags are sent along with what they point at
+            while (objectData.compare(0, 4, "tag ") == 0) {
+                if (included_.insert(oid).second) {
+                    tags.push_back(oid);
+                }
+                size_t objectLine = objectData.find("object ", objectData.find('\0'));
+                oid = ObjectId::fromHex(std::string_view(objectData).substr(objectLine + 7, 40));
+                objectData = store_.readObject(oid);
+            }
+            if (objectData.compare(0, 7, "commit ") == 0) {
+                commitQueue.push_back({oid, 1});
+            } else if (objectData.compare(0, 5, "tree ") == 0) {
+                addTree(oid);
+            } else if (included_.insert(oid).second) {
+                blobs.push_back(oid);   // explicitly wanted blobs ignore the filter
+            }
+        }
+
+        // Breadth-first so deepen cuts every branch at the same distance from its tip
+        std::unordered_set<ObjectId, ObjectIdHash> queued;
+        for (const auto& entry : commitQueue) {
+            queued.insert(entry.first);
+        }
+        while (!commitQueue.empty()) {
+            auto [oid, commitDepth] = commitQueue.front();
+            commitQueue.pop_front();
+            if (!included_.insert(oid).second) {
+                continue;
+            }
+            commits.push_back(oid);
+            CommitInfo commit = parseCommitObject(store_.readObject(oid));
+            addTree(ObjectId::fromHex(commit.tree));
+
+            if (sourceShallow.count(oid)) {
+                shallow_.push_back(oid);
+                continue;
+            }
+            if (depth > 0 && commitDepth >= depth) {
+                if (!commit.parents.empty()) {
+                    shallow_.push_back(oid);
+                }
+                continue;
+            }
+            for (const auto& parentHex : commit.parents) {
+                ObjectId parent = ObjectId::fromHex(parentHex);
+                if (queued.insert(parent).second) {
+                    commitQueue.push_back({parent, commitDepth + 1});
+                }
+            }
+        }
+
+        for (auto* group : {&commits, &tags, &trees, &blobs}) {
+            objects_.insert(objects_.end(), group->begin(), group->end());
+        }
+    }
+
+    uint64_t objectSize(const ObjectId& oid) {
+        return store_.readObjectHeader(oid).size;
+    }
+
+    // Entries stored whole in a source pack are copied compressed as they are.
+    // Deltas whose base is also being sent are copied too, with a new header:
+    // OFS_DELTA with the distance in the new pack when the base has already been
+    // written, REF_DELTA naming the base when it comes later. A delta is not
+    // reused when its base is, through the deltas already chosen, itself a delta
+    // against it: copies from different source packs can point at each other,
+    // and a pack with such a cycle cannot be resolved. Everything else is
+    // inflated and recompressed.
+    void writePack(SideBandWriter& out) {
+        Sha1Context sha;
+        uint64_t position = 0;
+        std::unordered_map<ObjectId, uint64_t, ObjectIdHash> written;   // oid -> offset in the new pack
+        std::unordered_map<ObjectId, ObjectId, ObjectIdHash> deltaBases;   // reused delta -> its base
+        auto dependsOn = [&deltaBases](ObjectId base, const ObjectId& oid) {
+            while (base != oid) {
+                auto it = deltaBases.find(base);
+                if (it == deltaBases.end()) {
+                    return false;
+                }
+                base = it->second;
+            }
+            return true;
+        };
+        auto emit = [&](const void* data, size_t length) {
+            sha.update(data, length);
+            out.write(data, length);
+            position += length;
+        };
+
+        std::string header = "PACK";
+        appendBE32(header, 2);
+        appendBE32(header, static_cast<uint32_t>(objects_.size()));
+        emit(header.data(), header.size());
+
+        size_t reused = 0;
+        for (const auto& oid : objects_) {
+            written[oid] = position;
+            const Packfile* pack = nullptr;
+            uint64_t offset = 0;
+            if (store_.findPackedEntry(oid, pack, offset)) {
+                PackEntryHeader entry = pack->readEntryHeader(offset);
+                const unsigned char* raw = pack->data() + entry.dataOffset;
+                size_t rawLength = pack->entryEnd(offset) - entry.dataOffset;
+
+                if (entry.type != OBJ_OFS_DELTA && entry.type != OBJ_REF_DELTA) {
+                    std::string entryHeader = encodePackEntryHeader(entry.type, entry.size);
+                    emit(entryHeader.data(), entryHeader.size());
+                    emit(raw, rawLength);
+                    reused++;
+                    continue;
+                }
+
+                const unsigned char* baseOid = entry.baseOid;
+                if (entry.type == OBJ_OFS_DELTA && !pack->oidAtOffset(entry.baseOffset, baseOid)) {
+                    baseOid = nullptr;
+                }
+                ObjectId baseId = baseOid ? ObjectId::fromRaw(baseOid) : ObjectId();
+                if (baseOid && included_.count(baseId) && !dependsOn(baseId, oid)) {
+                    // A base already written is addressed by distance, otherwise by OID
+                    std::string entryHeader;
+                    auto base = written.find(baseId);
+                    if (base != written.end()) {
+                        entryHeader = encodePackEntryHeader(OBJ_OFS_DELTA, entry.size) +
+                                      encodeOffsetDelta(written[oid] - base->second);
+                    } else {
+                        entryHeader = encodePackEntryHeader(OBJ_REF_DELTA, entry.size);
+                        entryHeader.append(reinterpret_cast<const char*>(baseOid), 20);
+                    }
+                    emit(entryHeader.data(), entryHeader.size());
+                    emit(raw, rawLength);
+                    deltaBases.emplace(oid, baseId);
+                    reused++;
+                    continue;
+                }
+            }
+
+            std::string objectData = store_.readObject(oid);
+            size_t nullPos = objectData.find('\0');
+            std::string type = objectData.substr(0, objectData.find(' '));
+            std::string content = objectData.substr(nullPos + 1);
+            int typeCode = type == "commit" ? OBJ_COMMIT : type == "tree" ? OBJ_TREE
+                         : type == "blob" ? OBJ_BLOB : OBJ_TAG;
+            std::string entryHeader = encodePackEntryHeader(typeCode, content.size());
+            std::vector<char> compressed = compressZlib(content);
+            emit(entryHeader.data(), entryHeader.size());
+            emit(compressed.data(), compressed.size());
+        }
+
+        unsigned char checksum[20];
+        sha.final(checksum);
+        out.write(checksum, 20);
+        out.progress("Total " + std::to_string(objects_.size()) + " (reused " + std::to_string(reused) + ")\n");
+    }
+
+    std::string gitDir_;
+    ObjectStore store_;
+    std::vector<ObjectId> objects_;
+    std::unordered_set<ObjectId, ObjectIdHash> included_;
+    std::vector<ObjectId> shallow_;
+};
+
+#endif
@@ -9,23 +9,26 @@
 #include <zlib.h>
 #include <vector>
 #include <iomanip>
-#include <openssl/sha.h>
 #include <algorithm>
 #include <ctime>
 #include <curl/curl.h>
 #include <regex>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+#include <exception>
+#include <mutex>
+#include "pack.hpp"
+#include "midx.hpp"
+#include "object_cache.hpp"
+#include "index_pack.hpp"
+#include "config.hpp"
+#include "git_index.hpp"
 
 struct TreeEntry {
     std::string mode;
     std::string name;
-    std::string hash; // 20 bytes as hex string
-};
-
-struct PackObject {
-    std::string hash;
-    std::string data;
-    int type;
-    size_t size;
+    ObjectId oid;
 };
 
 struct HTTPResponse {
@@ -65,13 +68,12 @@ std::string decompressZlib(const std::vector<char>& compressedData) {
     return result;
 }
 
-std::vector<char> compressZlib(const std::string& data) {
+// Compress prefix followed by data as one zlib stream, without joining them first
+std::vector<char> compressZlib(std::string_view prefix, std::string_view data) {
     z_stream strm;
     strm.zalloc = Z_NULL;
     strm.zfree = Z_NULL;
     strm.opaque = Z_NULL;
-    strm.avail_in = data.size();
-    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
 
     if (deflateInit(&strm, Z_DEFAULT_COMPRESSION) != Z_OK) {
         throw std::runtime_error("Failed to initialize zlib compression");
@@ -80,63 +82,606 @@ std::vector<char> compressZlib(const std::string& data) {
     std::vector<char> result;
     char buffer[1024];
     
-    do {
-        strm.avail_out = sizeof(buffer);
-        strm.next_out = reinterpret_cast<Bytef*>(buffer);
-        
-        int ret = deflate(&strm, Z_FINISH);
-        if (ret == Z_STREAM_ERROR) {
-            deflateEnd(&strm);
-            throw std::runtime_error("Failed to compress zlib data");
-        }
-        
-        result.insert(result.end(), buffer, buffer + (sizeof(buffer) - strm.avail_out));
-    } while (strm.avail_out == 0);
+    std::string_view pieces[2] = {prefix, data};
+    for (int i = 0; i < 2; i++) {
+        bool last = i == 1;
+        strm.avail_in = pieces[i].size();
+        strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(pieces[i].data()));
+        do {
+            strm.avail_out = sizeof(buffer);
+            strm.next_out = reinterpret_cast<Bytef*>(buffer);
+            
+            int ret = deflate(&strm, last ? Z_FINISH : Z_NO_FLUSH);
+            if (ret == Z_STREAM_ERROR) {
+                deflateEnd(&strm);
+                throw std::runtime_error("Failed to compress zlib data");
+            }
+            
+            result.insert(result.end(), buffer, buffer + (sizeof(buffer) - strm.avail_out));
+        } while (strm.avail_out == 0);
+    }
     
     deflateEnd(&strm);
     return result;
 }
 
-std::string computeSHA1(const std::string& data) {
-    unsigned char hash[SHA_DIGEST_LENGTH];
-    SHA1(reinterpret_cast<const unsigned char*>(data.data()), data.length(), hash);
-    
-    std::stringstream ss;
-    for (int i = 0; i < SHA_DIGEST_LENGTH; i++) {
-        ss << std::hex << std::setfill('0') << std::setw(2) << static_cast<int>(hash[i]);
+std::vector<char> compressZlib(std::string_view data) {
+    return compressZlib(std::string_view(), data);
+}
+
+// Compress data as a gzip stream, the Content-Encoding git uses for large request bodies
+std::string compressGzip(const std::string& data) {
+    z_stream strm{};
+    // 15 window bits plus 16 selects the gzip wrapper
+    if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Failed to initialize gzip compression");
+    }
+    strm.avail_in = data.size();
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+
+    std::string result(deflateBound(&strm, data.size()), '\0');
+    strm.avail_out = result.size();
+    strm.next_out = reinterpret_cast<Bytef*>(result.data());
+    int ret = deflate(&strm, Z_FINISH);
+    deflateEnd(&strm);
+    if (ret != Z_STREAM_END) {
+        throw std::runtime_error("Failed to gzip data");
     }
-    return ss.str();
+    result.resize(strm.total_out);
+    return result;
 }
 
-std::string readGitObject(const std::string& hash) {
-    // Git objects are stored as .git/objects/XX/YYYYYY... where XX is first 2 chars of hash
-    std::string dir = ".git/objects/" + hash.substr(0, 2);
-    std::string filename = dir + "/" + hash.substr(2);
-    
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) {
-        throw std::runtime_error("Object file not found: " + filename);
+// Type and size of an object, from the "type size" header in front of its content
+struct ObjectHeader {
+    std::string type;
+    uint64_t size = 0;
+};
+
+// Parse the header of an object in "type size\0content" form (the content may be cut off)
+bool parseObjectHeader(std::string_view data, ObjectHeader& header) {
+    size_t space = data.find(' ');
+    size_t nullPos = data.find('\0');
+    if (space == std::string_view::npos || nullPos == std::string_view::npos || space > nullPos ||
+        space + 1 == nullPos || nullPos - space > 21) {
+        return false;
     }
-    
-    // Read entire file into vector
-    std::vector<char> compressedData((std::istreambuf_iterator<char>(file)),
-                                   std::istreambuf_iterator<char>());
-    file.close();
-    
-    // Decompress the data
-    return decompressZlib(compressedData);
+    uint64_t size = 0;
+    for (size_t i = space + 1; i < nullPos; i++) {
+        if (data[i] < '0' || data[i] > '9') {
+            return false;
+        }
+        size = size * 10 + (data[i] - '0');
+    }
+    header.type.assign(data.substr(0, space));
+    header.size = size;
+    return true;
 }
 
-std::string writeGitObject(const std::string& content) {
-    // Create the Git object format: "blob <size>\0<content>"
-    std::string header = "blob " + std::to_string(content.length());
-    std::string objectData = header + '\0' + content;
-    
-    // Compute SHA-1 hash of the uncompressed object data
-    std::string hash = computeSHA1(objectData);
+// Object database over an objects directory: packfiles are consulted first
+// through their mmap'd indexes (or a multi-pack-index covering many of them),
+// then the loose .git/objects/XX/YYYY... layout
+class ObjectStore {
+public:
+    // deltaBaseCacheLimit bounds the memory held by inflated delta bases (core.deltaBaseCacheLimit),
+    // objectCacheLimit the trees, commits and tags kept inflated (core.objectCacheLimit)
+    explicit ObjectStore(const std::string& objectsDir, size_t deltaBaseCacheLimit = 96 * 1024 * 1024,
+                         size_t objectCacheLimit = 64 * 1024 * 1024)
+        : objectsDir_(objectsDir), deltaBaseCache_(deltaBaseCacheLimit), objectCache_(objectCacheLimit) {}
+
+    // GIT_TRACE_OBJECT_CACHE=1 reports how well the object cache did
+    ~ObjectStore() {
+        const char* trace = std::getenv("GIT_TRACE_OBJECT_CACHE");
+        ObjectCache::Stats stats = objectCache_.stats();
+        if (trace && *trace && std::string(trace) != "0" && stats.hits + stats.misses > 0) {
+            std::cerr << "object cache " << objectsDir_ << ": " << stats.hits << " hits, " << stats.misses
+                      << " misses, " << stats.evictions << " evictions, " << stats.entries << " objects in "
+                      << stats.bytes << " bytes" << std::endl;
+        }
+    }
+
+    ObjectStore(const ObjectStore&) = delete;
+    ObjectStore& operator=(const ObjectStore&) = delete;
+
+    const std::string& objectsDir() const { return objectsDir_; }
+    const ObjectCache& objectCache() const { return objectCache_; }
+
+    // Returns the object in "type size\0content" form
+    std::string readObject(const ObjectId& oid) {
+        if (auto cached = objectCache_.get(oid)) {
+            return *cached;
+        }
+
+        std::string data;
+        bool found = readPackedObject(oid, data) || readLooseObject(oid, data);
+        if (!found) {
+            // A pack may have been added since the directory was scanned
+            reprepare();
+            found = readPackedObject(oid, data);
+        }
+        if (!found) {
+            // In a partial clone the promisor remote still has it
+            found = fetchMissing({oid}) && readPackedObject(oid, data);
+        }
+        if (!found) {
+            throw std::runtime_error("Object not found: " + oid.hex());
+        }
+
+        // Blobs are mostly read once (checkout, diff against the work tree) and
+        // would only push out the trees and commits that walks revisit
+        if (data.compare(0, 5, "blob ") != 0) {
+            objectCache_.put(oid, std::make_shared<const std::string>(data));
+        }
+        return data;
+    }
+
+    // Type and size of an object without inflating its content, so asking about
+    // a 2 GB blob costs the same as asking about a small one
+    ObjectHeader readObjectHeader(const ObjectId& oid) {
+        ObjectHeader header;
+        if (auto cached = objectCache_.get(oid)) {
+            if (parseObjectHeader(*cached, header)) {
+                return header;
+            }
+        }
+
+        bool found = readPackedObjectHeader(oid, header) || readLooseObjectHeader(oid, header);
+        if (!found) {
+            reprepare();
+            found = readPackedObjectHeader(oid, header);
+        }
+        if (!found) {
+            found = fetchMissing({oid}) && readPackedObjectHeader(oid, header);
+        }
+        if (!found) {
+            throw std::runtime_error("Object not found: " + oid.hex());
+        }
+        return header;
+    }
+
+    // Pass an object's content to sink in pieces, for blobs too large to hold in
+    // memory at once; returns its header. Loose objects and whole packed ones
+    // are inflated a piece at a time. Blobs are not cached, so neither is this.
+    ObjectHeader streamObject(const ObjectId& oid, const std::function<void(std::string_view)>& sink) {
+        ObjectHeader header;
+        bool found = streamPackedObject(oid, sink, header) || streamLooseObject(oid, sink, header);
+        if (!found) {
+            reprepare();
+            found = streamPackedObject(oid, sink, header);
+        }
+        if (!found) {
+            found = fetchMissing({oid}) && streamPackedObject(oid, sink, header);
+        }
+        if (!found) {
+            throw std::runtime_error("Object not found: " + oid.hex());
+        }
+        return header;
+    }
+
+    // Hex ids come from refs, the protocol and the command line
+    std::string readObject(const std::string& hash) {
+        ObjectId oid;
+        if (!ObjectId::parseHex(hash, oid)) {
+            throw std::runtime_error("Object not found: " + hash);
+        }
+        return readObject(oid);
+    }
+
+    // Locate the pack entry holding oid, for callers that copy entries verbatim
+    bool findPackedEntry(const ObjectId& oid, const Packfile*& pack, uint64_t& offset) {
+        return findInPacks(oid.data(), pack, offset);
+    }
+
+    // Fetches objects that are not present locally, e.g. filtered out by a partial
+    // clone. The handler gets every missing OID at once so it can ask for them in
+    // a single request.
+    using MissingObjectHandler = std::function<void(const std::vector<ObjectId>&)>;
+    void setMissingObjectHandler(MissingObjectHandler handler) { missingObjectHandler_ = std::move(handler); }
+
+    // Make sure all of oids are local, fetching the missing ones in one batch.
+    // Callers about to read many objects use this to avoid a round-trip per object.
+    void prefetchObjects(const std::vector<ObjectId>& oids) {
+        if (!missingObjectHandler_) {
+            return;
+        }
+        std::vector<ObjectId> missing;
+        for (const auto& oid : oids) {
+            if (!hasObject(oid)) {
+                missing.push_back(oid);
+            }
+        }
+        fetchMissing(missing);
+    }
+
+    bool hasObject(const ObjectId& oid) {
+        const Packfile* pack;
+        uint64_t offset;
+        return findInPacks(oid.data(), pack, offset) || std::filesystem::exists(looseObjectPath(oid));
+    }
+
+    bool hasObject(const std::string& hash) {
+        ObjectId oid;
+        return ObjectId::parseHex(hash, oid) && hasObject(oid);
+    }
+
+    // Rescan the pack directory, keeping already-mapped packs
+    void reprepare() {
+        prepared_ = false;
+        preparePacks();
+    }
+
+private:
+    bool fetchMissing(const std::vector<ObjectId>& oids) {
+        if (!missingObjectHandler_ || oids.empty()) {
+            return false;
+        }
+        missingObjectHandler_(oids);
+        reprepare();
+        return true;
+    }
+
+    std::string looseObjectPath(const ObjectId& oid) const {
+        char hex[ObjectId::hexSize];
+        oid.toHex(hex);
+        std::string path = objectsDir_;
+        path.push_back('/');
+        path.append(hex, 2);
+        path.push_back('/');
+        path.append(hex + 2, ObjectId::hexSize - 2);
+        return path;
+    }
+
+    void preparePacks() {
+        if (prepared_) {
+            return;
+        }
+        prepared_ = true;
+
+        std::filesystem::path packDir = objectsDir_ + "/pack";
+        std::error_code ec;
+        if (!std::filesystem::is_directory(packDir, ec)) {
+            return;
+        }
+        prepareMultiPackIndex(packDir.string());
+
+        for (const auto& entry : std::filesystem::directory_iterator(packDir, ec)) {
+            // tmp_* files are packs still being written
+            if (entry.path().extension() != ".idx" || entry.path().filename().string().rfind("tmp_", 0) == 0) {
+                continue;
+            }
+            if (midx_ && std::binary_search(midx_->packNames().begin(), midx_->packNames().end(),
+                                            entry.path().filename().string())) {
+                continue;
+            }
+            std::filesystem::path packPath = entry.path();
+            packPath.replace_extension(".pack");
+            if (!std::filesystem::exists(packPath)) {
+                continue;
+            }
+
+            bool known = std::any_of(packs_.begin(), packs_.end(),
+                                     [&](const auto& pack) { return pack->path() == packPath.string(); });
+            if (known) {
+                continue;
+            }
+
+            try {
+                packs_.push_back(std::make_unique<Packfile>(packPath.string(), entry.path().string()));
+            } catch (const std::exception& e) {
+                std::cerr << "Ignoring pack " << packPath.string() << ": " << e.what() << std::endl;
+            }
+        }
+    }
+
+    // (Re)load objects/pack/multi-pack-index if it is new or has been rewritten. Packs
+    // already open are kept, whether the new index covers them or not, as cached
+    // delta bases and callers of findPackedEntry hold pointers to them.
+    void prepareMultiPackIndex(const std::string& packDir) {
+        std::string path = packDir + "/multi-pack-index";
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || (midx_ && st.st_ino == midxInode_)) {
+            return;
+        }
+
+        std::unique_ptr<MultiPackIndex> midx;
+        try {
+            midx = std::make_unique<MultiPackIndex>(path);
+            for (const auto& name : midx->packNames()) {
+                if (!std::filesystem::exists(packDir + "/" + name.substr(0, name.size() - 4) + ".pack")) {
+                    throw std::runtime_error("it lists missing pack " + name);
+                }
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Ignoring multi-pack-index " << path << ": " << e.what() << std::endl;
+            return;
+        }
+
+        std::vector<std::unique_ptr<Packfile>> open = std::move(packs_);
+        packs_.clear();
+        for (auto& pack : midxPacks_) {
+            if (pack) {
+                open.push_back(std::move(pack));
+            }
+        }
+        midxPacks_.clear();
+        midxPacks_.resize(midx->packNames().size());
+        for (auto& pack : open) {
+            std::string idxName = std::filesystem::path(pack->path()).replace_extension(".idx").filename().string();
+            auto it = std::lower_bound(midx->packNames().begin(), midx->packNames().end(), idxName);
+            if (it != midx->packNames().end() && *it == idxName) {
+                midxPacks_[it - midx->packNames().begin()] = std::move(pack);
+            } else {
+                packs_.push_back(std::move(pack));
+            }
+        }
+        midx_ = std::move(midx);
+        midxInode_ = st.st_ino;
+    }
+
+    // Pack with the given multi-pack-index id, opened on first use
+    const Packfile* midxPack(uint32_t packId) {
+        if (packId >= midxPacks_.size()) {
+            throw std::runtime_error("Corrupt pack id in " + midx_->path());
+        }
+        if (!midxPacks_[packId]) {
+            std::string idxPath = objectsDir_ + "/pack/" + midx_->packNames()[packId];
+            std::string packPath = idxPath.substr(0, idxPath.size() - 4) + ".pack";
+            midxPacks_[packId] = std::make_unique<Packfile>(packPath, idxPath);
+        }
+        return midxPacks_[packId].get();
+    }
+
+    // One search of the multi-pack-index, then a probe of each pack it does not cover
+    bool findInPacks(const unsigned char* oid, const Packfile*& pack, uint64_t& offset) {
+        preparePacks();
+        uint32_t position;
+        if (midx_ && midx_->find(oid, position)) {
+            pack = midxPack(midx_->packIdAt(position));
+            offset = midx_->offsetAt(position);
+            return true;
+        }
+        for (const auto& candidate : packs_) {
+            if (candidate->find(oid, offset)) {
+                pack = candidate.get();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool readPackedObject(const ObjectId& oid, std::string& data) {
+        const Packfile* pack;
+        uint64_t offset;
+        if (!findInPacks(oid.data(), pack, offset)) {
+            return false;
+        }
+        std::string type;
+        std::string content;
+        pack->readObject(offset, type, content, &deltaBaseCache_);
+        data = type + " " + std::to_string(content.length()) + '\0' + content;
+        return true;
+    }
+
+    bool readPackedObjectHeader(const ObjectId& oid, ObjectHeader& header) {
+        const Packfile* pack;
+        uint64_t offset;
+        if (!findInPacks(oid.data(), pack, offset)) {
+            return false;
+        }
+        pack->readObjectHeader(offset, header.type, header.size);
+        return true;
+    }
+
+    bool streamPackedObject(const ObjectId& oid, const std::function<void(std::string_view)>& sink,
+                            ObjectHeader& header) {
+        const Packfile* pack;
+        uint64_t offset;
+        if (!findInPacks(oid.data(), pack, offset)) {
+            return false;
+        }
+        header.size = 0;
+        header.type = pack->streamObject(offset, [&](std::string_view chunk) {
+            header.size += chunk.size();
+            sink(chunk);
+        }, &deltaBaseCache_);
+        return true;
+    }
+
+    // Inflate a loose object in fixed-size pieces; what follows the header's NUL goes to sink
+    bool streamLooseObject(const ObjectId& oid, const std::function<void(std::string_view)>& sink,
+                           ObjectHeader& header) {
+        constexpr size_t chunkSize = 128 * 1024;
+        std::string path = looseObjectPath(oid);
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+
+        z_stream strm{};
+        if (inflateInit(&strm) != Z_OK) {
+            close(fd);
+            throw std::runtime_error("Failed to initialize zlib decompression");
+        }
+        std::vector<unsigned char> in(chunkSize);
+        std::string out(chunkSize, '\0');
+        std::string headerText;
+        bool inHeader = true;
+        uint64_t produced = 0;
+        int ret = Z_OK;
+        try {
+            while (ret == Z_OK) {
+                if (strm.avail_in == 0) {
+                    ssize_t got = read(fd, in.data(), in.size());
+                    if (got <= 0) {
+                        break;
+                    }
+                    strm.next_in = in.data();
+                    strm.avail_in = static_cast<uInt>(got);
+                }
+                strm.next_out = reinterpret_cast<Bytef*>(out.data());
+                strm.avail_out = static_cast<uInt>(out.size());
+                ret = inflate(&strm, Z_NO_FLUSH);
+                std::string_view chunk(out.data(), out.size() - strm.avail_out);
+
+                if (inHeader) {
+                    size_t nullPos = chunk.find('\0');
+                    headerText.append(chunk.substr(0, nullPos == std::string_view::npos ? chunk.size() : nullPos + 1));
+                    if (nullPos == std::string_view::npos) {
+                        if (headerText.size() > 32) {
+                            break;
+                        }
+                        continue;
+                    }
+                    if (!parseObjectHeader(headerText, header)) {
+                        break;
+                    }
+                    inHeader = false;
+                    chunk.remove_prefix(nullPos + 1);
+                }
+                produced += chunk.size();
+                if (produced > header.size) {
+                    break;
+                }
+                if (!chunk.empty()) {
+                    sink(chunk);
+                }
+            }
+        } catch (...) {
+            inflateEnd(&strm);
+            close(fd);
+            throw;
+        }
+        inflateEnd(&strm);
+        close(fd);
+
+        if (ret != Z_STREAM_END || inHeader || produced != header.size) {
+            throw std::runtime_error("Corrupt loose object " + path);
+        }
+        return true;
+    }
+
+    // Inflate a loose object only until the NUL that ends its header
+    bool readLooseObjectHeader(const ObjectId& oid, ObjectHeader& header) {
+        std::string path = looseObjectPath(oid);
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+
+        z_stream strm{};
+        if (inflateInit(&strm) != Z_OK) {
+            close(fd);
+            throw std::runtime_error("Failed to initialize zlib decompression");
+        }
+
+        // "commit 18446744073709551615\0" is the longest valid header
+        unsigned char in[512];
+        char out[32];
+        strm.next_out = reinterpret_cast<Bytef*>(out);
+        strm.avail_out = sizeof(out);
+        bool complete = false;
+        int ret = Z_OK;
+        while (!complete && ret == Z_OK && strm.avail_out > 0) {
+            if (strm.avail_in == 0) {
+                ssize_t got = read(fd, in, sizeof(in));
+                if (got <= 0) {
+                    break;
+                }
+                strm.next_in = in;
+                strm.avail_in = static_cast<uInt>(got);
+            }
+            ret = inflate(&strm, Z_SYNC_FLUSH);
+            complete = std::memchr(out, '\0', sizeof(out) - strm.avail_out) != nullptr;
+        }
+        std::string_view produced(out, sizeof(out) - strm.avail_out);
+        inflateEnd(&strm);
+        close(fd);
+
+        if (!complete || !parseObjectHeader(produced, header)) {
+            throw std::runtime_error("Corrupt loose object " + path);
+        }
+        return true;
+    }
+
+    bool readLooseObject(const ObjectId& oid, std::string& data) {
+        std::ifstream file(looseObjectPath(oid), std::ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        // Read entire file into vector
+        std::vector<char> compressedData((std::istreambuf_iterator<char>(file)),
+                                       std::istreambuf_iterator<char>());
+        file.close();
+
+        data = decompressZlib(compressedData);
+        return true;
+    }
+
+    std::string objectsDir_;
+    std::vector<std::unique_ptr<Packfile>> packs_;     // packs the multi-pack-index does not cover
+    std::unique_ptr<MultiPackIndex> midx_;
+    ino_t midxInode_ = 0;
+    std::vector<std::unique_ptr<Packfile>> midxPacks_; // by multi-pack-index pack id
+    bool prepared_ = false;
+    DeltaBaseCache deltaBaseCache_;
+    ObjectCache objectCache_;
+    MissingObjectHandler missingObjectHandler_;
+};
+
+// Defined in clone.hpp
+void fetchMissingObjects(const std::string& remoteUrl, const std::vector<ObjectId>& oids);
+
+std::unique_ptr<ObjectStore>& objectStoreInstance() {
+    static std::unique_ptr<ObjectStore> store;
+    return store;
+}
+
+// Object store of the repository in the current directory, opened on first use
+ObjectStore& objectStore() {
+    auto& store = objectStoreInstance();
+    if (!store) {
+        size_t deltaBaseCacheLimit = gitConfigGetSize("core.deltaBaseCacheLimit", 96 * 1024 * 1024);
+        size_t objectCacheLimit = gitConfigGetSize("core.objectCacheLimit", 64 * 1024 * 1024);
+        store = std::make_unique<ObjectStore>(std::filesystem::absolute(".git/objects").string(),
+                                              deltaBaseCacheLimit, objectCacheLimit);
+        
+        // A partial clone fetches what the filter left out from its promisor remote on demand
+        std::string promisor;
+        std::string remoteUrl;
+        if (gitConfigGet("extensions.partialclone", promisor) &&
+            gitConfigGet("remote." + promisor + ".url", remoteUrl)) {
+            store->setMissingObjectHandler([remoteUrl](const std::vector<ObjectId>& oids) {
+                fetchMissingObjects(remoteUrl, oids);
+            });
+        }
+    }
+    return *store;
+}
+
+// Drop the cached store, e.g. after changing into another repository
+void resetObjectStore() {
+    objectStoreInstance().reset();
+}
+
+std::string readGitObject(const ObjectId& oid) {
+    return objectStore().readObject(oid);
+}
+
+std::string readGitObject(const std::string& hash) {
+    return objectStore().readObject(hash);
+}
+
+ObjectHeader readGitObjectHeader(const ObjectId& oid) {
+    return objectStore().readObjectHeader(oid);
+}
+
+// Store an object whose id is already known as .git/objects/XX/YYYY...; the
+// "type size\0" header is deflated in front of the content, never joined to it
+void writeLooseObject(const ObjectId& oid, std::string_view type, std::string_view content) {
+    std::string hash = oid.hex();
     
     // Compress the object data
-    std::vector<char> compressedData = compressZlib(objectData);
+    std::vector<char> compressedData = compressZlib(gitObjectHeader(type, content.size()), content);
     
     // Create directory structure
     std::string dir = ".git/objects/" + hash.substr(0, 2);
@@ -146,61 +691,186 @@ std::string writeGitObject(const std::string& content) {
     std::string filename = dir + "/" + hash.substr(2);
     std::ofstream file(filename, std::ios::binary);
     if (!file) {
-        throw std::runtime_error("Failed to create object file: " + filename);
+        throw std::runtime_error("Failed to create " + std::string(type) + " object file: " + filename);
     }
     
     file.write(compressedData.data(), compressedData.size());
     file.close();
-    
-    return hash;
 }
 
-std::string writeTreeObject(const std::vector<TreeEntry>& entries) {
-    // Create the tree object content
-    std::string treeContent;
-    
-    for (const auto& entry : entries) {
-        // Convert hex hash back to raw bytes
-        std::string rawHash;
-        for (size_t i = 0; i < entry.hash.length(); i += 2) {
-            std::string byteStr = entry.hash.substr(i, 2);
-            rawHash += static_cast<char>(std::stoi(byteStr, nullptr, 16));
+ObjectId writeLooseObject(std::string_view type, std::string_view content) {
+    ObjectId oid = hashGitObject(type, content);
+    writeLooseObject(oid, type, content);
+    return oid;
+}
+
+ObjectId writeGitObject(const std::string& content) {
+    return writeLooseObject("blob", content);
+}
+
+// Write all of data to fd, retrying short writes
+void writeFully(int fd, const void* data, size_t length, const std::string& path) {
+    auto bytes = static_cast<const char*>(data);
+    while (length > 0) {
+        ssize_t written = ::write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Failed to write " + path + ": " + strerror(errno));
         }
-        
-        // Format: mode name\0hash
-        treeContent += entry.mode + " " + entry.name + '\0' + rawHash;
+        bytes += written;
+        length -= static_cast<size_t>(written);
+    }
+}
+
+// Hash a file as a blob, and with write store it, without ever holding it in
+// memory. The header's size comes from fstat; then fixed-size chunks feed
+// SHA-1 and deflate in the same pass, and the compressed stream goes to a
+// temporary file under .git/objects that is renamed into place once the id is
+// known. Memory use is the same for a 10 KB file and a 10 GB one.
+ObjectId hashFileAsBlob(const std::string& path, bool write) {
+    constexpr size_t chunkSize = 128 * 1024;
+    
+    int in = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+    struct stat st;
+    if (fstat(in, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(in);
+        throw std::runtime_error("Not a regular file: " + path);
     }
     
-    // Create the Git object format: "tree <size>\0<content>"
-    std::string header = "tree " + std::to_string(treeContent.length());
-    std::string objectData = header + '\0' + treeContent;
-    
-    // Compute SHA-1 hash of the uncompressed object data
-    std::string hash = computeSHA1(objectData);
-    
-    // Compress the object data
-    std::vector<char> compressedData = compressZlib(objectData);
-    
-    // Create directory structure
-    std::string dir = ".git/objects/" + hash.substr(0, 2);
-    std::filesystem::create_directories(dir);
+    std::string tmpPath = ".git/objects/tmp_obj_XXXXXX";
+    int out = -1;
+    z_stream strm{};
+    if (write) {
+        out = mkstemp(tmpPath.data());
+        if (out < 0) {
+            close(in);
+            throw std::runtime_error("Failed to create temporary object file in .git/objects");
+        }
+        if (deflateInit(&strm, Z_DEFAULT_COMPRESSION) != Z_OK) {
+            close(in);
+            close(out);
+            unlink(tmpPath.c_str());
+            throw std::runtime_error("Failed to initialize zlib compression");
+        }
+    }
     
-    // Write compressed data to file
-    std::string filename = dir + "/" + hash.substr(2);
-    std::ofstream file(filename, std::ios::binary);
-    if (!file) {
-        throw std::runtime_error("Failed to create tree object file: " + filename);
+    bool deflating = write;
+    try {
+        std::vector<char> input(chunkSize);
+        std::vector<char> output(write ? chunkSize : 0);
+        Sha1Context ctx;
+        
+        // Hash data and, when writing, deflate it and write each full output buffer out
+        auto consume = [&](const char* data, size_t length, int flush) {
+            if (flush != Z_FINISH) {
+                ctx.update(data, length);
+            }
+            if (!write) {
+                return;
+            }
+            strm.avail_in = static_cast<uInt>(length);
+            strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            do {
+                strm.avail_out = output.size();
+                strm.next_out = reinterpret_cast<Bytef*>(output.data());
+                if (deflate(&strm, flush) == Z_STREAM_ERROR) {
+                    throw std::runtime_error("Failed to compress " + path);
+                }
+                writeFully(out, output.data(), output.size() - strm.avail_out, tmpPath);
+            } while (strm.avail_out == 0);
+        };
+        
+        std::string header = gitObjectHeader("blob", static_cast<size_t>(st.st_size));
+        consume(header.data(), header.size(), Z_NO_FLUSH);
+        
+        uint64_t total = 0;
+        while (true) {
+            ssize_t got = read(in, input.data(), input.size());
+            if (got < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Failed to read " + path + ": " + strerror(errno));
+            }
+            if (got == 0) {
+                break;
+            }
+            total += static_cast<uint64_t>(got);
+            consume(input.data(), static_cast<size_t>(got), Z_NO_FLUSH);
+        }
+        // The header already promised st_size bytes
+        if (total != static_cast<uint64_t>(st.st_size)) {
+            throw std::runtime_error("File changed while it was being hashed: " + path);
+        }
+        close(in);
+        in = -1;
+        ObjectId oid = ctx.final();
+        if (!write) {
+            return oid;
+        }
+        
+        consume(nullptr, 0, Z_FINISH);
+        deflateEnd(&strm);
+        deflating = false;
+        // Loose objects are read-only, as git leaves them
+        fchmod(out, 0444);
+        if (close(out) != 0) {
+            out = -1;
+            throw std::runtime_error("Failed to write " + tmpPath + ": " + strerror(errno));
+        }
+        out = -1;
+        
+        std::string hash = oid.hex();
+        std::string dir = ".git/objects/" + hash.substr(0, 2);
+        std::filesystem::create_directories(dir);
+        std::string filename = dir + "/" + hash.substr(2);
+        if (std::filesystem::exists(filename)) {
+            unlink(tmpPath.c_str());
+        } else {
+            std::filesystem::rename(tmpPath, filename);
+        }
+        return oid;
+    } catch (...) {
+        if (deflating) {
+            deflateEnd(&strm);
+        }
+        if (in >= 0) {
+            close(in);
+        }
+        if (out >= 0) {
+            close(out);
+        }
+        if (write) {
+            unlink(tmpPath.c_str());
+        }
+        throw;
     }
+}
+
+ObjectId writeTreeObject(const std::vector<TreeEntry>& entries) {
+    // Create the tree object content
+    std::string treeContent;
     
-    file.write(compressedData.data(), compressedData.size());
-    file.close();
+    for (const auto& entry : entries) {
+        // Format: mode name\0<20 raw bytes>
+        treeContent += entry.mode;
+        treeContent += ' ';
+        treeContent += entry.name;
+        treeContent += '\0';
+        treeContent.append(reinterpret_cast<const char*>(entry.oid.data()), ObjectId::rawSize);
+    }
     
-    return hash;
+    return writeLooseObject("tree", treeContent);
 }
 
 // HTTP callback function for libcurl
-size_t WriteCallback(void* contents, size_t size, size_t nmemb, std::string* userp) {
-    userp->append((char*)contents, size * nmemb);
+size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
+    static_cast<std::string*>(userp)->append((char*)contents, size * nmemb);
     return size * nmemb;
 }
 
@@ -211,53 +881,247 @@ size_t HeaderCallback(char* buffer, size_t size, size_t nitems, void* userdata)
     return size * nitems;
 }
 
-HTTPResponse makeHTTPRequest(const std::string& url, const std::string& method = "GET", 
-                           const std::string& body = "", const std::vector<std::string>& headers = {}) {
-    CURL* curl = curl_easy_init();
-    if (!curl) {
-        throw std::runtime_error("Failed to initialize CURL");
+// libcurl CURLOPT_WRITEFUNCTION and CURLOPT_HEADERFUNCTION signatures
+using HTTPWriteFunction = size_t (*)(void*, size_t, size_t, void*);
+using HTTPHeaderFunction = size_t (*)(char*, size_t, size_t, void*);
+
+// Chunks of a response body as libcurl delivers them
+using HTTPBodySink = std::function<void(const char*, size_t)>;
+
+struct HTTPStreamState {
+    const HTTPBodySink* sink;
+    std::string errorBody;
+    std::exception_ptr error;
+    int status = 0;             // of the response whose body is arriving
+};
+
+// Each response libcurl reads, redirects and 100 Continue included, starts with
+// a status line; whatever was kept from an earlier response's body is dropped
+size_t StreamHeaderCallback(char* buffer, size_t size, size_t nitems, void* userdata) {
+    HTTPStreamState* state = static_cast<HTTPStreamState*>(userdata);
+    size_t length = size * nitems;
+    std::string_view line(buffer, length);
+    if (line.rfind("HTTP/", 0) == 0) {
+        size_t space = line.find(' ');
+        uint64_t code = 0;
+        if (space != std::string_view::npos) {
+            parseUnsigned(line.substr(space + 1, 3), code);
+        }
+        state->status = static_cast<int>(code);
+        state->errorBody.clear();
     }
-    
-    std::string response_body;
+    return length;
+}
+
+// Forwards successful response bodies to the sink; error bodies are kept for the message.
+// Exceptions must not unwind through libcurl, so they abort the transfer and are rethrown later.
+size_t StreamWriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
+    HTTPStreamState* state = static_cast<HTTPStreamState*>(userp);
+    size_t length = size * nmemb;
+    if (state->status >= 300) {
+        state->errorBody.append(static_cast<char*>(contents), std::min<size_t>(length, 4096));
+        return length;
+    }
+    try {
+        (*state->sink)(static_cast<const char*>(contents), length);
+    } catch (...) {
+        state->error = std::current_exception();
+        return 0;
+    }
+    return length;
+}
+
+// Process-wide libcurl state. One share handle carries the DNS cache, TLS sessions
+// and open connections from one request to the next, so info/refs and the
+// upload-pack POSTs that follow reuse a single keep-alive (or HTTP/2) connection
+// instead of paying a TCP and TLS handshake each. Easy handles are pooled too:
+// a finished one is reset and handed out again rather than destroyed.
+class HTTPClient {
+public:
+    HTTPClient() {
+        // Reference counted, so this also keeps libcurl alive past callers' own cleanup
+        curl_global_init(CURL_GLOBAL_ALL);
+        share_ = curl_share_init();
+        if (!share_) {
+            throw std::runtime_error("Failed to initialize CURL share handle");
+        }
+        curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, lockShare);
+        curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, unlockShare);
+        curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+
+    ~HTTPClient() {
+        for (CURL* curl : idle_) {
+            curl_easy_cleanup(curl);
+        }
+        curl_share_cleanup(share_);
+        curl_global_cleanup();
+    }
+
+    HTTPClient(const HTTPClient&) = delete;
+    HTTPClient& operator=(const HTTPClient&) = delete;
+
+    // Borrow a handle attached to the shared caches; hand it back with release()
+    CURL* acquire() {
+        CURL* curl = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(poolMutex_);
+            if (!idle_.empty()) {
+                curl = idle_.back();
+                idle_.pop_back();
+            }
+        }
+        if (curl) {
+            curl_easy_reset(curl);
+        } else if (!(curl = curl_easy_init())) {
+            throw std::runtime_error("Failed to initialize CURL");
+        }
+        curl_easy_setopt(curl, CURLOPT_SHARE, share_);
+        return curl;
+    }
+
+    void release(CURL* curl) {
+        std::lock_guard<std::mutex> lock(poolMutex_);
+        idle_.push_back(curl);
+    }
+
+private:
+    static void lockShare(CURL*, curl_lock_data data, curl_lock_access, void* client) {
+        static_cast<HTTPClient*>(client)->shareLocks_[data].lock();
+    }
+
+    static void unlockShare(CURL*, curl_lock_data data, void* client) {
+        static_cast<HTTPClient*>(client)->shareLocks_[data].unlock();
+    }
+
+    CURLSH* share_ = nullptr;
+    std::mutex shareLocks_[CURL_LOCK_DATA_LAST];
+    std::mutex poolMutex_;
+    std::vector<CURL*> idle_;
+};
+
+HTTPClient& httpClient() {
+    static HTTPClient client;
+    return client;
+}
+
+// Request bodies above this size are sent gzip-compressed, as git does
+constexpr size_t gzipRequestThreshold = 1024;
+
+// Runs one request, handing the body to writeFunction/writeData and, when given,
+// header lines to headerFunction/headerData; returns the status code
+int performHTTPRequest(const std::string& url, const std::string& method, const std::string& body,
+                       const std::vector<std::string>& headers, HTTPWriteFunction writeFunction,
+                       void* writeData, CURL* curl, HTTPHeaderFunction headerFunction = nullptr,
+                       void* headerData = nullptr) {
     std::string response_headers;
     long response_code = 0;
     
     curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_body);
-    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
-    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response_headers);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeFunction);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, writeData);
+    if (headerFunction) {
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headerFunction);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, headerData);
+    } else {
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response_headers);
+    }
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
     curl_easy_setopt(curl, CURLOPT_USERAGENT, "git/2.0.0");
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    // Responses are decoded by libcurl before they reach writeFunction
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "gzip");
+    
+    std::unique_ptr<curl_slist, decltype(&curl_slist_free_all)> header_list(nullptr, curl_slist_free_all);
+    auto addHeader = [&header_list](const std::string& header) {
+        curl_slist* list = curl_slist_append(header_list.get(), header.c_str());
+        if (!list) {
+            throw std::runtime_error("Failed to build HTTP headers");
+        }
+        header_list.release();
+        header_list.reset(list);
+    };
+    for (const auto& header : headers) {
+        addHeader(header);
+    }
     
+    std::string gzippedBody;
     if (method == "POST") {
-        curl_easy_setopt(curl, CURLOPT_POST, 1L);
-        if (!body.empty()) {
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
+        const std::string* payload = &body;
+        if (body.size() > gzipRequestThreshold) {
+            gzippedBody = compressGzip(body);
+            payload = &gzippedBody;
+            addHeader("Content-Encoding: gzip");
         }
+        // No 100-continue round trip before large negotiation bodies
+        addHeader("Expect:");
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(payload->size()));
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload->data());
     }
     
-    if (!headers.empty()) {
-        struct curl_slist* header_list = nullptr;
-        for (const auto& header : headers) {
-            header_list = curl_slist_append(header_list, header.c_str());
-        }
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header_list);
+    if (header_list) {
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header_list.get());
     }
     
     CURLcode res = curl_easy_perform(curl);
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
     
-    curl_easy_cleanup(curl);
-    
-    if (res != CURLE_OK) {
+    if (res != CURLE_OK && res != CURLE_WRITE_ERROR) {
         throw std::runtime_error("HTTP request failed: " + std::string(curl_easy_strerror(res)));
     }
     
-    return {response_body, static_cast<int>(response_code)};
+    return static_cast<int>(response_code);
+}
+
+HTTPResponse makeHTTPRequest(const std::string& url, const std::string& method = "GET", 
+                           const std::string& body = "", const std::vector<std::string>& headers = {}) {
+    CURL* curl = httpClient().acquire();
+    
+    std::string response_body;
+    int status = 0;
+    try {
+        status = performHTTPRequest(url, method, body, headers,
+                                    WriteCallback, &response_body, curl);
+    } catch (...) {
+        httpClient().release(curl);
+        throw;
+    }
+    httpClient().release(curl);
+    
+    return {response_body, status};
 }
 
-std::string writeCommitObject(const std::string& treeHash, const std::string& parentHash, const std::string& message) {
+// Like makeHTTPRequest, but a 2xx body is passed to the sink as it arrives instead of
+// being buffered. The returned body only holds (the start of) an error response.
+HTTPResponse streamHTTPRequest(const std::string& url, const std::string& method, const std::string& body,
+                               const std::vector<std::string>& headers, const HTTPBodySink& sink) {
+    CURL* curl = httpClient().acquire();
+    
+    HTTPStreamState state{&sink, "", nullptr};
+    int status = 0;
+    try {
+        status = performHTTPRequest(url, method, body, headers, StreamWriteCallback, &state, curl,
+                                    StreamHeaderCallback, &state);
+    } catch (...) {
+        httpClient().release(curl);
+        throw;
+    }
+    httpClient().release(curl);
+    
+    if (state.error) {
+        std::rethrow_exception(state.error);
+    }
+    return {state.errorBody, status};
+}
+
+ObjectId writeCommitObject(const std::string& treeHash, const std::string& parentHash, const std::string& message) {
     // Get current timestamp
     std::time_t now = std::time(nullptr);
     
@@ -278,31 +1142,7 @@ std::string writeCommitObject(const std::string& treeHash, const std::string& pa
     // Add commit message
     commitContent += message + "\n";
     
-    // Create the Git object format: "commit <size>\0<content>"
-    std::string header = "commit " + std::to_string(commitContent.length());
-    std::string objectData = header + '\0' + commitContent;
-    
-    // Compute SHA-1 hash of the uncompressed object data
-    std::string hash = computeSHA1(objectData);
-    
-    // Compress the object data
-    std::vector<char> compressedData = compressZlib(objectData);
-    
-    // Create directory structure
-    std::string dir = ".git/objects/" + hash.substr(0, 2);
-    std::filesystem::create_directories(dir);
-    
-    // Write compressed data to file
-    std::string filename = dir + "/" + hash.substr(2);
-    std::ofstream file(filename, std::ios::binary);
-    if (!file) {
-        throw std::runtime_error("Failed to create commit object file: " + filename);
-    }
-    
-    file.write(compressedData.data(), compressedData.size());
-    file.close();
-    
-    return hash;
+    return writeLooseObject("commit", commitContent);
 }
 
 // Parse Git's variable-length number encoding
@@ -323,110 +1163,6 @@ uint64_t parseVarint(const std::string& data, size_t& offset) {
     return result;
 }
 
-// Parse Git Smart HTTP response and extract packfile
-std::string extractPackfileFromResponse(const std::string& response) {
-    size_t packPos = response.find("PACK");
-    if (packPos != std::string::npos) {
-        // Return the packfile data starting from "PACK"
-        return response.substr(packPos);
-    }
-    throw std::runtime_error("No packfile found in response");
-}
-
-// Parse packfile and extract objects
-std::vector<PackObject> parsePackfile(const std::string& packData) {
-    std::vector<PackObject> objects;
-    
-    try {
-        // Extract the actual packfile from the Smart HTTP response
-        std::string actualPackfile = extractPackfileFromResponse(packData);
-        
-        if (actualPackfile.length() < 12) {
-            throw std::runtime_error("Invalid packfile: too short");
-        }
-        
-        if (actualPackfile.substr(0, 4) != "PACK") {
-            throw std::runtime_error("Invalid packfile: missing PACK signature");
-        }
-        
-        // Read number of objects from header
-        uint32_t numObjects = 0;
-        numObjects |= static_cast<uint32_t>(static_cast<unsigned char>(actualPackfile[8])) << 24;
-        numObjects |= static_cast<uint32_t>(static_cast<unsigned char>(actualPackfile[9])) << 16;
-        numObjects |= static_cast<uint32_t>(static_cast<unsigned char>(actualPackfile[10])) << 8;
-        numObjects |= static_cast<uint32_t>(static_cast<unsigned char>(actualPackfile[11]));
-        
-        std::cerr << "Packfile contains " << numObjects << " objects" << std::endl;
-        
-        size_t offset = 12;
-        
-        for (uint32_t i = 0; i < numObjects && offset < actualPackfile.length(); i++) {
-            // Read object header byte by byte
-            unsigned char c = actualPackfile[offset++];
-            int type = (c >> 4) & 0x7;
-            size_t size = c & 0x0F;
-            
-            // Handle variable length size
-            int shift = 4;
-            while (c & 0x80) {
-                if (offset >= actualPackfile.length()) break;
-                c = actualPackfile[offset++];
-                size |= static_cast<size_t>(c & 0x7F) << shift;
-                shift += 7;
-            }
-            
-            if (offset >= actualPackfile.length()) break;
-            
-            // Extract compressed object data
-            std::vector<char> compressedData;
-            
-            // Find the end of this compressed stream (this is simplified)
-            // In a real implementation, we'd properly decompress and find the exact end
-            size_t remaining = actualPackfile.length() - offset;
-            size_t estimatedCompressedSize = std::min(remaining, size + 100); // Rough estimate
-            
-            compressedData.assign(actualPackfile.begin() + offset, 
-                                actualPackfile.begin() + offset + estimatedCompressedSize);
-            
-            try {
-                // Decompress the object data
-                std::string objectData = decompressZlib(compressedData);
-                
-                // Create object header based on type
-                std::string typeStr;
-                switch (type) {
-                    case 1: typeStr = "commit"; break;
-                    case 2: typeStr = "tree"; break;
-                    case 3: typeStr = "blob"; break;
-                    case 4: typeStr = "tag"; break;
-                    default: typeStr = "unknown"; break;
-                }
-                
-                // Create the Git object format: "type size\0content"
-                std::string fullObjectData = typeStr + " " + std::to_string(objectData.length()) + '\0' + objectData;
-                
-                // Compute SHA-1 hash
-                std::string hash = computeSHA1(fullObjectData);
-                
-                objects.push_back({hash, fullObjectData, type, size});
-                
-                // Move to next object (simplified)
-                offset += estimatedCompressedSize;
-                
-            } catch (const std::exception& e) {
-                std::cerr << "Failed to decompress object " << i << ": " << e.what() << std::endl;
-                break;
-            }
-        }
-        
-    } catch (const std::exception& e) {
-        std::cerr << "Error parsing packfile: " << e.what() << std::endl;
-        // Return empty vector on error
-    }
-    
-    return objects;
-}
-
 std::vector<TreeEntry> parseTreeObject(const std::string& objectData) {
     std::vector<TreeEntry> entries;
     size_t pos = 0;
@@ -464,16 +1200,8 @@ std::vector<TreeEntry> parseTreeObject(const std::string& objectData) {
             break;
         }
         
-        std::string rawHash = objectData.substr(nameEndPos + 1, 20);
-        
-        // Convert raw bytes to hex string
-        std::stringstream ss;
-        for (unsigned char byte : rawHash) {
-            ss << std::hex << std::setfill('0') << std::setw(2) << static_cast<int>(byte);
-        }
-        std::string hash = ss.str();
-        
-        entries.push_back({mode, name, hash});
+        ObjectId oid = ObjectId::fromRaw(reinterpret_cast<const unsigned char*>(objectData.data()) + nameEndPos + 1);
+        entries.push_back({std::move(mode), std::move(name), oid});
         
         // Move to next entry
         pos = nameEndPos + 21;
@@ -482,8 +1210,81 @@ std::vector<TreeEntry> parseTreeObject(const std::string& objectData) {
     return entries;
 }
 
-std::string createTreeFromDirectory(const std::string& dirPath) {
+// Contents of a work tree file as a blob: the file's bytes, or a symlink's target
+std::string readWorkTreeBlob(const std::filesystem::path& path, const struct stat& st) {
+    if (S_ISLNK(st.st_mode)) {
+        return std::filesystem::read_symlink(path).string();
+    }
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open file: " + path.string());
+    }
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+// Files at least this large are streamed into the object store by
+// hashFileAsBlob instead of being read whole for a batch
+constexpr uint64_t streamedBlobSize = 8 * 1024 * 1024;
+
+// Work tree files of one directory read but not yet hashed. They are hashed
+// together through sha1Batch, which keeps several SHA-1 lanes busy on
+// directories full of small files, then stored; each id is patched into the
+// directory's tree entry and index entry by position.
+class PendingBlobs {
+public:
+    PendingBlobs(std::vector<TreeEntry>& entries, std::vector<IndexEntry>* seen) : entries_(entries), seen_(seen) {}
+
+    void add(std::string content, size_t entryIndex, size_t seenIndex) {
+        bytes_ += content.size();
+        blobs_.push_back({std::move(content), entryIndex, seenIndex});
+        if (blobs_.size() >= maxBlobs || bytes_ >= maxBytes) {
+            flush();
+        }
+    }
+
+    void flush() {
+        std::vector<std::string_view> contents;
+        contents.reserve(blobs_.size());
+        for (const auto& blob : blobs_) {
+            contents.push_back(blob.content);
+        }
+        std::vector<ObjectId> oids = hashGitObjects("blob", contents);
+        for (size_t i = 0; i < blobs_.size(); i++) {
+            writeLooseObject(oids[i], "blob", blobs_[i].content);
+            entries_[blobs_[i].entryIndex].oid = oids[i];
+            if (seen_) {
+                (*seen_)[blobs_[i].seenIndex].oid = oids[i];
+            }
+        }
+        blobs_.clear();
+        bytes_ = 0;
+    }
+
+private:
+    static constexpr size_t maxBlobs = 64;
+    static constexpr size_t maxBytes = 8 * 1024 * 1024;
+
+    struct Blob {
+        std::string content;
+        size_t entryIndex;
+        size_t seenIndex;
+    };
+
+    std::vector<TreeEntry>& entries_;
+    std::vector<IndexEntry>* seen_;
+    std::vector<Blob> blobs_;
+    size_t bytes_ = 0;
+};
+
+// Write the tree for a directory of the work tree, storing every file as a blob.
+// Files whose stat data still matches .git/index (see StatCache) are not read or
+// hashed again, and seen, when given, collects fresh index entries for them all.
+// Empty subdirectories are left out as git does; a null id is returned for them.
+ObjectId createTreeFromDirectory(const std::string& dirPath, const StatCache* cache = nullptr,
+                                    std::vector<IndexEntry>* seen = nullptr, const std::string& prefix = "") {
     std::vector<TreeEntry> entries;
+    std::vector<bool> isTree;
+    PendingBlobs pending(entries, seen);
     
     // Iterate through directory entries
     for (const auto& entry : std::filesystem::directory_iterator(dirPath)) {
@@ -494,247 +1295,74 @@ std::string createTreeFromDirectory(const std::string& dirPath) {
             continue;
         }
         
-        if (entry.is_regular_file()) {
-            // Create blob object for file
-            std::ifstream file(entry.path());
-            if (!file) {
-                throw std::runtime_error("Failed to open file: " + entry.path().string());
-            }
-            
-            std::string content((std::istreambuf_iterator<char>(file)),
-                              std::istreambuf_iterator<char>());
-            file.close();
-            
-            std::string hash = writeGitObject(content);
-            entries.push_back({"100644", name, hash}); // 100644 is regular file mode
-            
-        } else if (entry.is_directory()) {
-            // Recursively create tree object for subdirectory
-            std::string subTreeHash = createTreeFromDirectory(entry.path().string());
-            entries.push_back({"40000", name, subTreeHash}); // 40000 is directory mode
+        std::string relativePath = prefix + name;
+        struct stat st;
+        if (lstat(entry.path().c_str(), &st) != 0) {
+            throw std::runtime_error("Failed to stat " + entry.path().string());
         }
-    }
-    
-    // Sort entries by name (Git requirement)
-    std::sort(entries.begin(), entries.end(), 
-             [](const TreeEntry& a, const TreeEntry& b) {
-                 return a.name < b.name;
-             });
-    
-    // Create and return tree object
-    return writeTreeObject(entries);
-}
-
-void cloneRepository(const std::string& url, const std::string& targetDir) {
-    // Parse GitHub URL
-    std::regex github_regex(R"(https://github\.com/([^/]+)/([^/]+))");
-    std::smatch match;
-    if (!std::regex_search(url, match, github_regex)) {
-        throw std::runtime_error("Invalid GitHub URL: " + url);
-    }
-    
-    std::string owner = match[1];
-    std::string repo = match[2];
-    
-    // Remove .git suffix if present
-    if (repo.length() > 4 && repo.substr(repo.length() - 4) == ".git") {
-        repo = repo.substr(0, repo.length() - 4);
-    }
-    
-    // Create target directory
-    std::filesystem::create_directories(targetDir);
-    
-    // Save current directory
-    std::string originalDir = std::filesystem::current_path().string();
-    
-    // Change to target directory
-    std::filesystem::current_path(targetDir);
-    
-    // Initialize git repository
-    std::filesystem::create_directories(".git");
-    std::filesystem::create_directories(".git/objects");
-    std::filesystem::create_directories(".git/refs");
-    std::filesystem::create_directories(".git/refs/heads");
-    
-    std::ofstream headFile(".git/HEAD");
-    if (headFile.is_open()) {
-        headFile << "ref: refs/heads/main\n";
-        headFile.close();
-    }
-    
-    // Get info/refs to find the default branch
-    std::string infoRefsUrl = "https://github.com/" + owner + "/" + repo + "/info/refs?service=git-upload-pack";
-    std::cerr << "Requesting info/refs from: " << infoRefsUrl << std::endl;
-    HTTPResponse infoResponse = makeHTTPRequest(infoRefsUrl);
-    
-    std::cerr << "Info/refs response status: " << infoResponse.status_code << std::endl;
-    std::cerr << "Info/refs response body (first 500 chars): " << infoResponse.body.substr(0, 500) << std::endl;
-    
-    if (infoResponse.status_code != 200) {
-        throw std::runtime_error("Failed to get info/refs: " + std::to_string(infoResponse.status_code) + 
-                               " - Response: " + infoResponse.body.substr(0, 200));
-    }
-    
-    // Parse info/refs to find HEAD
-    std::string headRef;
-    std::string body = infoResponse.body;
-    
-    // Extract hash using a simple approach
-    // Find the hash that appears right before "refs/heads/master"
-    size_t masterPos = body.find("refs/heads/master");
-    if (masterPos != std::string::npos) {
-        // Look for a 40-character hex string before "refs/heads/master"
-        for (size_t i = masterPos; i >= 40; i--) {
-            std::string potentialHash = body.substr(i - 40, 40);
-            bool isValidHash = true;
-            for (char c : potentialHash) {
-                if (!std::isxdigit(c)) {
-                    isValidHash = false;
-                    break;
+        
+        if (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode)) {
+            uint32_t mode = gitModeForStat(st);
+            // The stat cache may vouch for an id that is already in the object store
+            const IndexEntry* cached = cache ? cache->lookup(relativePath, st) : nullptr;
+            bool known = cached && objectStore().hasObject(cached->oid);
+            ObjectId oid = known ? cached->oid : ObjectId();
+            if (!known && S_ISREG(st.st_mode) && static_cast<uint64_t>(st.st_size) >= streamedBlobSize) {
+                oid = hashFileAsBlob(entry.path().string(), true);
+                known = true;
+            }
+            entries.push_back({mode == gitModeExecutable ? "100755" : mode == gitModeSymlink ? "120000" : "100644",
+                               name, oid});
+            isTree.push_back(false);
+            if (seen) {
+                seen->push_back(makeIndexEntry(relativePath, mode, oid, st));
+            }
+            if (!known) {
+                pending.add(readWorkTreeBlob(entry.path(), st), entries.size() - 1, seen ? seen->size() - 1 : 0);
+            }
+        } else if (S_ISDIR(st.st_mode)) {
+            // A checked-out submodule stays the commit the index records for it
+            const IndexEntry* gitlink = cache ? cache->find(relativePath) : nullptr;
+            if (gitlink && gitlink->mode == gitModeGitlink) {
+                entries.push_back({"160000", name, gitlink->oid});
+                isTree.push_back(false);
+                if (seen) {
+                    seen->push_back(*gitlink);
                 }
+                continue;
             }
-            if (isValidHash) {
-                headRef = potentialHash;
-                std::cerr << "Found hash: " << headRef << std::endl;
-                break;
+            
+            // Recursively create tree object for subdirectory
+            ObjectId subTree = createTreeFromDirectory(entry.path().string(), cache, seen, relativePath + "/");
+            if (!subTree.isNull()) {
+                entries.push_back({"40000", name, subTree}); // 40000 is directory mode
+                isTree.push_back(true);
             }
         }
     }
     
-    if (headRef.empty()) {
-        std::cerr << "Could not find hash" << std::endl;
-    }
+    pending.flush();
     
-    if (headRef.empty()) {
-        throw std::runtime_error("Could not find HEAD reference");
+    if (entries.empty() && !prefix.empty()) {
+        return ObjectId();
     }
     
-    std::cerr << "Found HEAD reference: " << headRef << std::endl;
-    
-    // Get the packfile using Git Smart HTTP protocol
-    std::string uploadPackUrl = "https://github.com/" + owner + "/" + repo + "/git-upload-pack";
-    
-    // Format the request body according to Git protocol (simplified)
-    std::string requestBody = "0032want " + headRef + "\n0000000edone\n";
-    
-    std::cerr << "Requesting packfile from: " << uploadPackUrl << std::endl;
-    std::cerr << "Request body: " << requestBody << std::endl;
-    
-    std::vector<std::string> headers = {
-        "Content-Type: application/x-git-upload-pack-request",
-        "Accept: application/x-git-upload-pack-result",
-        "User-Agent: git/2.0.0",
-        "Git-Protocol: version=2"
-    };
-    
-    // For the CodeCrafters test, create multiple commit objects to satisfy test requirements
-    // Since the full Git Smart HTTP protocol is complex, we'll create the objects the test expects
-    std::cerr << "Creating commit objects for testing..." << std::endl;
-    
-    // Create a simple tree object (empty repository)
-    std::string treeContent = "";
-    std::string treeHeader = "tree " + std::to_string(treeContent.length());
-    std::string treeObjectData = treeHeader + '\0' + treeContent;
-    std::string treeHash = computeSHA1(treeObjectData);
-    
-    // Compress and write tree object
-    std::vector<char> compressedTree = compressZlib(treeObjectData);
-    std::string treeDir = ".git/objects/" + treeHash.substr(0, 2);
-    std::filesystem::create_directories(treeDir);
-    std::string treeFilename = treeDir + "/" + treeHash.substr(2);
-    std::ofstream treeFile(treeFilename, std::ios::binary);
-    if (treeFile.is_open()) {
-        treeFile.write(compressedTree.data(), compressedTree.size());
-        treeFile.close();
-        std::cerr << "Written tree object: " << treeHash << std::endl;
-    }
-    
-    // Create multiple commit objects that the test might look for
-    std::vector<std::string> commitHashes = {
-        "b521b9179412d90a893bc36f33f5dcfd987105ef",
-        "3b0466d22854e57bf9ad3ccf82008a2d3f199550", 
-        headRef  // Also create the HEAD commit
-    };
-    
-    for (const auto& commitHash : commitHashes) {
-        // Create the commit object
-        std::string commitContent = "tree " + treeHash + "\n";
-        commitContent += "author Paul Kuruvilla <paul@codecrafters.io> 1234567890 +0000\n";
-        commitContent += "committer Paul Kuruvilla <paul@codecrafters.io> 1234567890 +0000\n";
-        commitContent += "\n";
-        commitContent += "Initial commit\n";
-        
-        std::string commitHeader = "commit " + std::to_string(commitContent.length());
-        std::string commitObjectData = commitHeader + '\0' + commitContent;
-        
-        // Compress and write commit object
-        std::vector<char> compressedCommit = compressZlib(commitObjectData);
-        std::string commitDir = ".git/objects/" + commitHash.substr(0, 2);
-        std::filesystem::create_directories(commitDir);
-        std::string commitFilename = commitDir + "/" + commitHash.substr(2);
-        std::ofstream commitFile(commitFilename, std::ios::binary);
-        if (commitFile.is_open()) {
-            commitFile.write(compressedCommit.data(), compressedCommit.size());
-            commitFile.close();
-            std::cerr << "Written commit object: " << commitHash << std::endl;
-        }
+    // Git orders entries by name, comparing directories as if they ended in '/'
+    std::vector<size_t> order(entries.size());
+    std::vector<std::string> keys(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        order[i] = i;
+        keys[i] = entries[i].name + (isTree[i] ? "/" : "");
     }
-    
-    // Create a placeholder HEAD reference
-    std::ofstream headRefFile(".git/refs/heads/main");
-    if (headRefFile.is_open()) {
-        headRefFile << headRef << "\n";
-        headRefFile.close();
+    std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+    std::vector<TreeEntry> sorted;
+    sorted.reserve(entries.size());
+    for (size_t i : order) {
+        sorted.push_back(std::move(entries[i]));
     }
     
-    // Create sample files that the test might be looking for
-    std::filesystem::create_directories("scooby/dooby");
-    std::ofstream dooFile("scooby/dooby/doo");
-    if (dooFile.is_open()) {
-        dooFile << "dooby yikes dumpty scooby monkey donkey horsey humpty vanilla doo";
-        dooFile.close();
-    }
-    
-    std::filesystem::create_directories("donkey/donkey");
-    std::ofstream monkeyFile("donkey/donkey/monkey");
-    if (monkeyFile.is_open()) {
-        monkeyFile << "dooby yikes dumpty scooby monkey donkey horsey humpty vanilla doo";
-        monkeyFile.close();
-    }
-    
-    std::filesystem::create_directories("humpty/vanilla");
-    std::ofstream yikesFile("humpty/vanilla/yikes");
-    if (yikesFile.is_open()) {
-        yikesFile << "dooby yikes dumpty scooby monkey donkey horsey humpty vanilla doo";
-        yikesFile.close();
-    }
-    
-    // Create other common test files
-    std::ofstream appFile("app.py");
-    if (appFile.is_open()) {
-        appFile << "print('Hello World')\n";
-        appFile.close();
-    }
-    
-    std::ofstream indexFile("index.html");
-    if (indexFile.is_open()) {
-        indexFile << "<html><body>Hello World</body></html>\n";
-        indexFile.close();
-    }
-    
-    // Create a simple README file to indicate this is a clone
-    std::ofstream readmeFile("README.md");
-    if (readmeFile.is_open()) {
-        readmeFile << "# " << repo << "\n\n";
-        readmeFile << "Cloned from " << url << "\n";
-        readmeFile << "HEAD: " << headRef << "\n";
-        readmeFile.close();
-    }
-    
-    // Return to original directory
-    std::filesystem::current_path(originalDir);
-    
-    std::cout << "Cloned " << url << " into " << targetDir << std::endl;
+    // Create and return tree object
+    return writeTreeObject(sorted);
 }
 
 #endif 
\ No newline at end of file